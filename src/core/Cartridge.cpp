@@ -1,59 +1,49 @@
 #include "stdafx.h"
 #include "Cartridge.h"
-#include "MemoryMap.h"
-#include <algorithm>
-#include <cassert>
 
-Cartridge::Cartridge(std::vector<unsigned char>&& rom, int ramBanks) : _rom{ std::move(rom) },
-			_ram(ramBanks * MemoryMap::RamBankSize), _ramEnabled(false)
+Cartridge::Cartridge(std::shared_ptr<const RomImage> rom, int ramBanks) : _rom{ std::move(rom) },
+			_ram{ new CartridgeRam(ramBanks * RamBankSize) }, _ramEnabled(ramBanks != 0)
 {
+	UpdateBanks();
 }
 
-unsigned char Cartridge::RomReadByte(unsigned short address) const
+void Cartridge::UpdateBanks()
 {
-	auto bank = address < MemoryMap::RomBankSize ? 0 : _selectedRomBank;
-	auto index = (address & MemoryMap::RomBankSize - 1) + bank * MemoryMap::RomBankSize;
+	_lowerRom = _rom->GetBank(_lowerRomBank);
+	_selectedRom = _rom->GetBank(_selectedRomBank);
 
-	assert(index < _rom.size());
-	return _rom[index];
+	// Bank numbers beyond the RAM fitted wrap around, as the upper bank lines aren't connected
+	auto ramBanks = _ram->Size() / RamBankSize;
+	_selectedRam = _ramEnabled && ramBanks != 0 ? _ram->Data() + _selectedRamBank % ramBanks * RamBankSize : nullptr;
+}
+
+bool Cartridge::OpenSaveFile(const std::string& filePath)
+{
+	if (_ram->Size() == 0) return false;
+
+	auto ram = CartridgeRam::OpenSaveFile(filePath, _ram->Size());
+	if (ram == nullptr) return false;
+
+	_ram = std::move(ram);
+	UpdateBanks();
+
+	return true;
 }
 
 unsigned char Cartridge::RamReadByte(unsigned short address) const
 {
-	return _ramEnabled ? _ram[address + _selectedRamBank * MemoryMap::RamBankSize] : 0x0;
+	// Open bus
+	return _selectedRam != nullptr ? _selectedRam[address] : 0xff;
 }
 
 void Cartridge::RomWriteByte(unsigned short address, unsigned char value)
 {
-	if (address < 0x2000)
-	{
-		_ramEnabled = (value & 0xa) == 0xa;
-	}
-	else if (address >= 0x2000 && address < 0x4000)
-	{
-		_selectedRomBank = (_selectedRomBank & 0x60) | std::max(1, value & 0x1f);
-	}
-	else if (address < 0x6000)
-	{
-		if (_mode == Mode::FourMbRom)
-		{
-			_selectedRamBank = value & 0x3;
-		}
-		else
-		{
-			_selectedRomBank = (_selectedRomBank & 0x1f) | (value & 0x3) << 5;
-		}
-	}
-	else
-	{
-		_mode = value & 0x1 ? Mode::FourMbRom : Mode::SixteenMbRom;
-	}
 }
 
 void Cartridge::RamWriteByte(unsigned short address, unsigned char value)
 {
-	if (_ramEnabled)
-	{
-		_ram[address + _selectedRamBank * MemoryMap::RamBankSize] = value;
-	}
+	if (_selectedRam == nullptr) return;
+
+	_selectedRam[address] = value;
+	_ram->MarkDirty(_selectedRam + address - _ram->Data());
 }
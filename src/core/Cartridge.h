@@ -1,30 +1,67 @@
 #pragma once
-#include <vector>
+#include <memory>
+#include <string>
+#include "CartridgeRam.h"
+#include "RomImage.h"
 
+// Cartridge without a memory bank controller: 32KB of ROM and optionally 8KB of RAM, always mapped.
+// Mappers derive from this, handling writes to their control registers and calling UpdateBanks
+// whenever they switch banks, so that reads never need to work out where the selected banks are
 class Cartridge
 {
 protected:
-	std::vector<unsigned char> _rom;
-	std::vector<unsigned char> _ram;
+	static const unsigned short RamBankSize = 1 << 13;
 
+	// ROM shared with any other cartridges running the same game. Only the bank controller's state and RAM are per-cartridge
+	std::shared_ptr<const RomImage> _rom;
+	std::unique_ptr<CartridgeRam> _ram;
+
+	// Banks mapped at 0x0000-0x3fff, 0x4000-0x7fff and 0xa000-0xbfff
+	int _lowerRomBank{ 0 };
 	int _selectedRomBank{ 1 };
 	int _selectedRamBank{ 0 };
 
-	enum class Mode
-	{
-		SixteenMbRom,
-		FourMbRom
-	};
-
-	Mode _mode{ Mode::SixteenMbRom };
 	bool _ramEnabled;
 
+	// Memory backing the banks above, refreshed by UpdateBanks. _selectedRam is null while RAM is inaccessible
+	const unsigned char* _lowerRom;
+	const unsigned char* _selectedRom;
+	unsigned char* _selectedRam;
+
+	virtual void UpdateBanks();
+
 public:
-	Cartridge(std::vector<unsigned char>&& rom, int ramBanks);
+	Cartridge(std::shared_ptr<const RomImage> rom, int ramBanks);
+	virtual ~Cartridge() = default;
+
+	const std::shared_ptr<const RomImage>& GetRom() const { return _rom; }
+
+	// Moves the cartridge's RAM into the save file at filePath, creating the file if needed, so that it's
+	// kept between sessions. Returns false, leaving RAM as it was, if there's no RAM or the file can't be
+	// mapped, which includes it being in use by another cartridge
+	bool OpenSaveFile(const std::string& filePath);
+
+	// RAM kept in a save file has to be written through RamWriteByte, so that writes are tracked
+	bool IsRamPersistent() const { return _ram->IsPersistent(); }
+
+	int GetLowerRomBank() const { return _lowerRomBank; }
+	int GetSelectedRomBank() const { return _selectedRomBank; }
+
+	const unsigned char* GetLowerRom() const { return _lowerRom; }
+	const unsigned char* GetSelectedRom() const { return _selectedRom; }
+
+	// Memory backing the selected RAM bank, or null while it's disabled, missing or not plain RAM (such as
+	// a clock register), in which case it's accessed through RamReadByte/RamWriteByte
+	unsigned char* GetSelectedRam() const { return _selectedRam; }
+
+	unsigned char RomReadByte(unsigned short address) const
+	{
+		return address < RomImage::BankSize ? _lowerRom[address] : _selectedRom[address - RomImage::BankSize];
+	}
 
-	unsigned char RomReadByte(unsigned short address) const;
-	unsigned char RamReadByte(unsigned short address) const;
+	virtual unsigned char RamReadByte(unsigned short address) const;
 
-	void RomWriteByte(unsigned short address, unsigned char value);
-	void RamWriteByte(unsigned short address, unsigned char value);
+	// Writes to ROM go to the memory bank controller's registers
+	virtual void RomWriteByte(unsigned short address, unsigned char value);
+	virtual void RamWriteByte(unsigned short address, unsigned char value);
 };
@@ -1,23 +1,67 @@
 #pragma once
 #include "Cartridge.h"
-#include <fstream>
+#include "Mbc1Cartridge.h"
+#include "Mbc2Cartridge.h"
+#include "Mbc3Cartridge.h"
+#include "Mbc5Cartridge.h"
+#include "RomImage.h"
 #include <memory>
+#include <string>
 
 class CartridgeFactory
 {
 public:
-	static std::shared_ptr<Cartridge> LoadFromFile(std::string filePath, int ramBanks)
+	// Creates a cartridge with the memory bank controller and RAM described by the ROM's header. Returns
+	// null if the ROM is too small to have a header or needs a controller that isn't emulated
+	static std::shared_ptr<Cartridge> Create(std::shared_ptr<const RomImage> rom)
 	{
-		std::ifstream ifs(filePath, std::ios::binary | std::ios::ate);
-		if (!ifs) return nullptr;
+		auto header = rom->GetHeader();
+		if (header == nullptr) return nullptr;
 
-		auto pos = ifs.tellg();
+		auto ramBanks = header->GetRamBanks();
 
-		auto buffer = std::vector<unsigned char>(static_cast<int>(pos));
+		switch (header->GetMapper())
+		{
+		case CartridgeHeader::Mapper::RomOnly:
+			return std::make_shared<Cartridge>(rom, ramBanks);
 
-		ifs.seekg(0, std::ios::beg);
-		ifs.read(reinterpret_cast<char*>(buffer.data()), pos);
+		case CartridgeHeader::Mapper::Mbc1:
+			return std::make_shared<Mbc1Cartridge>(rom, ramBanks);
 
-		return std::make_shared<Cartridge>(std::move(buffer), ramBanks);
+		case CartridgeHeader::Mapper::Mbc2:
+			return std::make_shared<Mbc2Cartridge>(rom);
+
+		case CartridgeHeader::Mapper::Mbc3:
+			return std::make_shared<Mbc3Cartridge>(rom, ramBanks);
+
+		case CartridgeHeader::Mapper::Mbc5:
+			return std::make_shared<Mbc5Cartridge>(rom, ramBanks);
+
+		default:
+			return nullptr;
+		}
+	}
+
+	// The conventional save file for a ROM: its path with the extension changed to .sav
+	static std::string GetSavePath(std::string romPath)
+	{
+		auto extension = romPath.find_last_of("./\\");
+		if (extension != std::string::npos && romPath[extension] == '.') romPath.erase(extension);
+
+		return romPath + ".sav";
+	}
+
+	// Loads a cartridge with its ROM read from filePath. RAM is only kept between sessions if savePath is
+	// given and the header declares a battery, and then only by the first cartridge to open the file.
+	// Otherwise each cartridge has RAM of its own in memory. Returns null if the file can't be read.
+	// Emulators running the same game can share its ROM by creating their cartridges from one RomImage instead
+	static std::shared_ptr<Cartridge> LoadFromFile(const std::string& filePath, const std::string& savePath = std::string())
+	{
+		auto rom = RomImage::LoadFromFile(filePath);
+		auto cartridge = rom != nullptr ? Create(rom) : nullptr;
+
+		if (cartridge != nullptr && !savePath.empty() && rom->GetHeader()->HasBattery()) cartridge->OpenSaveFile(savePath);
+
+		return cartridge;
 	}
 };
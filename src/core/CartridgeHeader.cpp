@@ -0,0 +1,116 @@
+#include "stdafx.h"
+#include "CartridgeHeader.h"
+#include <cstdint>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <emmintrin.h>
+#define CARTRIDGE_HEADER_SSE2
+#endif
+
+CartridgeHeader::Mapper CartridgeHeader::MapperFromType(unsigned char cartridgeType)
+{
+	switch (cartridgeType)
+	{
+	// Optionally with RAM and battery
+	case 0x00: case 0x08: case 0x09:
+		return Mapper::RomOnly;
+
+	case 0x01: case 0x02: case 0x03:
+		return Mapper::Mbc1;
+
+	case 0x05: case 0x06:
+		return Mapper::Mbc2;
+
+	case 0x0f: case 0x10: case 0x11: case 0x12: case 0x13:
+		return Mapper::Mbc3;
+
+	case 0x19: case 0x1a: case 0x1b: case 0x1c: case 0x1d: case 0x1e:
+		return Mapper::Mbc5;
+
+	default:
+		return Mapper::Unsupported;
+	}
+}
+
+std::unique_ptr<const CartridgeHeader> CartridgeHeader::Parse(const unsigned char* rom, size_t size)
+{
+	if (size < End) return nullptr;
+
+	std::unique_ptr<CartridgeHeader> header{ new CartridgeHeader() };
+
+	// Colour games use the last byte of the title as a flag
+	auto titleEnd = rom + ((rom[CgbFlagAddress] & 0x80) != 0 ? CgbFlagAddress : CgbFlagAddress + 1);
+	auto title = rom + TitleAddress;
+	while (title != titleEnd && *title != 0) header->_title.push_back(static_cast<char>(*title++));
+
+	header->_cartridgeType = rom[CartridgeTypeAddress];
+	header->_mapper = MapperFromType(header->_cartridgeType);
+
+	// 32KB doubled for each step
+	auto romSize = rom[RomSizeAddress];
+	header->_romBanks = romSize <= 8 ? 2 << romSize : 0;
+
+	// 2KB RAM is counted as a whole bank
+	static const int ramBanks[] = { 0, 1, 1, 4, 16, 8 };
+	auto ramSize = rom[RamSizeAddress];
+	header->_ramBanks = ramSize < sizeof(ramBanks) / sizeof(ramBanks[0]) ? ramBanks[ramSize] : 0;
+
+	switch (header->_cartridgeType)
+	{
+	case 0x03: case 0x06: case 0x09: case 0x0d: case 0x0f: case 0x10: case 0x13: case 0x1b: case 0x1e: case 0xff:
+		header->_hasBattery = true;
+		break;
+
+	default:
+		header->_hasBattery = false;
+	}
+
+	header->_hasRtc = header->_cartridgeType == 0x0f || header->_cartridgeType == 0x10;
+
+	unsigned char headerChecksum = 0;
+	for (auto address = TitleAddress; address < HeaderChecksumAddress; address++) headerChecksum -= rom[address] + 1;
+	header->_headerChecksumValid = headerChecksum == rom[HeaderChecksumAddress];
+
+	header->_rom = rom;
+	header->_romSize = size;
+	header->_globalChecksumValid = false;
+
+	return std::move(header);
+}
+
+bool CartridgeHeader::IsGlobalChecksumValid() const
+{
+	// Headers are shared along with their ROM images, so may be asked from several threads at once
+	std::call_once(_globalChecksumChecked, [this]
+	{
+		// Big-endian sum of every byte other than its own
+		auto globalChecksum = static_cast<unsigned short>(SumBytes(_rom, _romSize) - _rom[GlobalChecksumAddress] - _rom[GlobalChecksumAddress + 1]);
+		_globalChecksumValid = globalChecksum == (_rom[GlobalChecksumAddress] << 8 | _rom[GlobalChecksumAddress + 1]);
+	});
+
+	return _globalChecksumValid;
+}
+
+unsigned short CartridgeHeader::SumBytes(const unsigned char* data, size_t size)
+{
+	size_t i = 0;
+	uint64_t sum = 0;
+
+#ifdef CARTRIDGE_HEADER_SSE2
+	// PSADBW against zero adds each 8 bytes into a 64-bit lane, 16 bytes per instruction
+	auto zero = _mm_setzero_si128();
+	auto totals = zero;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		totals = _mm_add_epi64(totals, _mm_sad_epu8(bytes, zero));
+	}
+
+	sum = _mm_cvtsi128_si64(totals) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(totals, totals));
+#endif
+
+	for (; i < size; i++) sum += data[i];
+
+	return static_cast<unsigned short>(sum);
+}
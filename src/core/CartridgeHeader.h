@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Cartridge properties described by the header at 0x0100-0x014f of the ROM
+class CartridgeHeader
+{
+public:
+	enum class Mapper
+	{
+		RomOnly,
+		Mbc1,
+		Mbc2,
+		Mbc3,
+		Mbc5,
+		Unsupported
+	};
+
+	static const unsigned short End = 0x150;
+
+private:
+	static const unsigned short TitleAddress = 0x134;
+	static const unsigned short CgbFlagAddress = 0x143;
+	static const unsigned short CartridgeTypeAddress = 0x147;
+	static const unsigned short RomSizeAddress = 0x148;
+	static const unsigned short RamSizeAddress = 0x149;
+	static const unsigned short HeaderChecksumAddress = 0x14d;
+	static const unsigned short GlobalChecksumAddress = 0x14e;
+
+	std::string _title;
+	unsigned char _cartridgeType;
+	Mapper _mapper;
+	int _romBanks;
+	int _ramBanks;
+	bool _hasBattery;
+	bool _hasRtc;
+	bool _headerChecksumValid;
+
+	// Checking the global checksum means summing the whole ROM, which nothing does on the way to
+	// running it, so it's left until first asked for
+	const unsigned char* _rom;
+	size_t _romSize;
+	mutable std::once_flag _globalChecksumChecked;
+	mutable bool _globalChecksumValid;
+
+	CartridgeHeader() = default;
+
+	static Mapper MapperFromType(unsigned char cartridgeType);
+
+public:
+	// Parses the header of a ROM, validating its header checksum. The header keeps a pointer to the ROM to validate
+	// the global checksum later, so the ROM must outlive it. Returns null if the ROM is too small to have a header
+	static std::unique_ptr<const CartridgeHeader> Parse(const unsigned char* rom, size_t size);
+
+	// Sum of the bytes, modulo 2^16
+	static unsigned short SumBytes(const unsigned char* data, size_t size);
+
+	const std::string& GetTitle() const { return _title; }
+	unsigned char GetCartridgeType() const { return _cartridgeType; }
+	Mapper GetMapper() const { return _mapper; }
+
+	// Bank counts declared by the header. ROM banks are 16KB, RAM banks 8KB. RAM built into the
+	// memory bank controller, as on MBC2, isn't included
+	int GetRomBanks() const { return _romBanks; }
+	int GetRamBanks() const { return _ramBanks; }
+
+	bool HasBattery() const { return _hasBattery; }
+	bool HasRtc() const { return _hasRtc; }
+
+	// The boot ROM refuses to start a cartridge with a bad header checksum. The global checksum isn't checked by the hardware
+	bool IsHeaderChecksumValid() const { return _headerChecksumValid; }
+	bool IsGlobalChecksumValid() const;
+};
@@ -0,0 +1,48 @@
+#include "stdafx.h"
+#include "CartridgeRam.h"
+#include "SaveFileFlusher.h"
+#include <algorithm>
+
+CartridgeRam::CartridgeRam(size_t size) : _buffer(size), _data(_buffer.data()), _size(size), _regionSize(1), _dirtyRegions(0)
+{
+}
+
+CartridgeRam::CartridgeRam(std::unique_ptr<MappedFile> file)
+	: _file{ std::move(file) }, _data(_file->WritableData()), _size(_file->Size()), _dirtyRegions(0)
+{
+	const size_t MinRegionSize = 1 << 12;
+
+	_regionSize = MinRegionSize;
+	while (_regionSize * MaxRegions < _size) _regionSize *= 2;
+
+	SaveFileFlusher::Add(this);
+}
+
+CartridgeRam::~CartridgeRam()
+{
+	if (_file == nullptr) return;
+
+	SaveFileFlusher::Remove(this);
+	Flush();
+}
+
+std::unique_ptr<CartridgeRam> CartridgeRam::OpenSaveFile(const std::string& filePath, size_t size)
+{
+	auto file = MappedFile::OpenWritable(filePath, size);
+	return file != nullptr ? std::unique_ptr<CartridgeRam>(new CartridgeRam(std::move(file))) : nullptr;
+}
+
+void CartridgeRam::Flush()
+{
+	if (_file == nullptr) return;
+
+	auto dirtyRegions = _dirtyRegions.exchange(0, std::memory_order_relaxed);
+
+	for (auto region = 0; dirtyRegions != 0; region++, dirtyRegions >>= 1)
+	{
+		if ((dirtyRegions & 1) == 0) continue;
+
+		auto offset = region * _regionSize;
+		_file->Flush(offset, std::min(_regionSize, _size - offset));
+	}
+}
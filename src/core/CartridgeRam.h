@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+// RAM on a cartridge, held in memory or, when battery-backed, in a memory-mapped save file so that it
+// survives between sessions. Writes to a save file only mark the region they fall in as dirty, and
+// SaveFileFlusher writes dirty regions back to the file in the background, so the emulation thread
+// never waits on the disk
+class CartridgeRam
+{
+	static const int MaxRegions = 32;
+
+	std::vector<unsigned char> _buffer;
+	std::unique_ptr<MappedFile> _file;
+
+	unsigned char* _data;
+	size_t _size;
+
+	// One bit per region of the save file written to since it was last flushed. Regions are at least 4KB
+	size_t _regionSize;
+	std::atomic<uint32_t> _dirtyRegions;
+
+	explicit CartridgeRam(std::unique_ptr<MappedFile> file);
+
+public:
+	explicit CartridgeRam(size_t size);
+
+	// Flushes what's left of a save file on the destroying thread, so blocks on the disk
+	~CartridgeRam();
+
+	CartridgeRam(const CartridgeRam&) = delete;
+	CartridgeRam& operator=(const CartridgeRam&) = delete;
+
+	// Maps size bytes of RAM from the save file at filePath, creating it if needed. Returns null if it can't
+	// be mapped, including when another cartridge already has it open
+	static std::unique_ptr<CartridgeRam> OpenSaveFile(const std::string& filePath, size_t size);
+
+	unsigned char* Data() const { return _data; }
+	size_t Size() const { return _size; }
+
+	// Returns true if the RAM is kept in a save file, in which case writes need to go through MarkDirty
+	bool IsPersistent() const { return _file != nullptr; }
+
+	// Notes a write to the byte at offset, for the flusher to pick up
+	void MarkDirty(size_t offset)
+	{
+		if (_file != nullptr) _dirtyRegions.fetch_or(1u << (offset / _regionSize), std::memory_order_relaxed);
+	}
+
+	bool IsDirty() const { return _dirtyRegions.load(std::memory_order_relaxed) != 0; }
+
+	// Writes every dirty region back to the save file
+	void Flush();
+};
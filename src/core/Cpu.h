@@ -1,5 +1,11 @@
 #pragma once
+#include "CpuFwd.h"
 #include "MemoryMap.h"
+#include "DecodedBlockCache.h"
+#include "Recompiler.h"
+#include <array>
+#include <functional>
+#include <utility>
 #include <vector>
 
 // Avoids enum class to simplify bit-level operations
@@ -32,6 +38,34 @@ enum class CpuState
 	Stopped
 };
 
+// Selects how the CPU dispatches opcodes to their handlers
+enum class CpuEngine
+{
+	// Reference interpreter calling through a member function pointer per instruction
+	JumpTable,
+
+	// Threaded interpreter (computed goto where the compiler supports it, otherwise a switch)
+	// that runs a whole cycle budget per call
+	Threaded,
+
+	// Threaded interpreter that hands hot ROM blocks to the x86-64 recompiler
+	Recompiler
+};
+
+// Kind of the last flag-setting operation, while flags are being evaluated lazily
+enum class FlagOp : unsigned char
+{
+	// F is up to date
+	None,
+	Add,
+	Sub,
+	And,
+	OrXor,
+	Inc,
+	Dec,
+	Bit
+};
+
 // Register file representation for CPU
 struct Registers
 {
@@ -57,8 +91,39 @@ struct Registers
 	}
 };
 
-// Gameboy LR35902 CPU
-class Cpu
+// CPU state at a taken backward jump, kept to spot loops that spin without side effects
+struct LoopSnapshot
+{
+	unsigned short Target;
+	Registers LoopRegisters;
+	FlagOp LoopFlagOp;
+	unsigned char FlagOperand1;
+	unsigned char FlagOperand2;
+	unsigned char FlagResult;
+	bool FlagCarry;
+	bool InterruptsEnabled;
+	uint64_t WriteCount;
+	uint64_t TotalCycles;
+};
+
+// Access to a watched address, reported by the CPU
+struct WatchpointHit
+{
+	unsigned short Address;
+	unsigned char Value;
+	WatchAccess Access;
+
+	// Program counter during the access, which has moved past the instruction's operands read so far,
+	// and total cycles elapsed before the instruction started
+	unsigned short PC;
+	uint64_t Cycle;
+};
+
+// Gameboy LR35902 CPU, templated on the memory bus it runs against so that the bus's accessors inline into
+// the opcode handlers. Bus must be a MemoryMap or derive from it, which the decoded block cache reads code through.
+// Member definitions are in CpuImpl.h, and the production CPU is instantiated in Cpu.cpp
+template<typename Bus>
+class CpuCore
 {
 	//Machine cycles in terms of system clocks
 	static const int OneCycle	 = 4;
@@ -69,8 +134,9 @@ class Cpu
 	static const int SixCycles   = OneCycle * 6;
 
 	static const unsigned short HiMemBaseAddress = 0xff00;
-	static const unsigned short WaitingInterruptsAddress = 0xff0f;
-	static const unsigned short EnabledInterruptsAddress = 0xffff;
+
+	// Index of the (HL) operand within the 8-bit register encoding of opcode bits 0-2 and 3-5
+	static const int IndirectHlIndex = 6;
 
 	const std::vector<std::pair<InterruptFlags, unsigned char>> _intVectors
 	{
@@ -82,10 +148,11 @@ class Cpu
 	};
 
 protected:
-	MemoryMap& _memoryMap;
+	Bus& _memoryMap;
 	Registers _registers;
 
 	CpuState _state;
+	CpuEngine _engine;
 	uint64_t _totalCycles;
 	int _extraCyclesConsumed;
 
@@ -100,14 +167,50 @@ protected:
 
 	bool _interruptCheckRequired;
 
+	// Lazy flags used by the specialised handlers. Unless _flagOp is None, F is stale and is derived on demand
+	// from the last flag-setting operation's operands and result. _flagCarry holds the carry in for ADD/SUB
+	// variants, and the carry flag preserved by INC/DEC/BIT
+	FlagOp _flagOp;
+	unsigned char _flagOperand1;
+	unsigned char _flagOperand2;
+	unsigned char _flagResult;
+	bool _flagCarry;
+
 	const std::vector<unsigned char(*)(unsigned char& dest, unsigned char src, bool carry)> _aluOps;
 	const std::vector<void(*)(unsigned char& dest, unsigned char& flags)> _prefixCbOps;
 
 	// Jump table for all top-level opcodes
-	const std::vector<int(Cpu::*)(unsigned char opcode)> _opcodeJumpTable;
+	const std::vector<int(CpuCore::*)(unsigned char opcode)> _opcodeJumpTable;
+
+	// Decoded code used by the threaded engine. _nextDecoded/_decodedEnd track the remainder of the block
+	// being executed, and _decodedOperand the operand bytes of the current instruction
+	DecodedBlockCache _blockCache;
+	const DecodedInstruction* _nextDecoded;
+	const DecodedInstruction* _decodedEnd;
+	const unsigned char* _decodedOperand;
+
+	// Set when a write may have switched the ROM bank or internal ROM mapping, which ends compiled blocks
+	bool _codeRemapped;
+
+	// Idle loop detection for the threaded engines. _cycleBudgetEnd is the total cycle count the current
+	// run ends at, and _writeCount counts every memory write made by the CPU
+	LoopSnapshot _loopSnapshot;
+	bool _loopSnapshotValid;
+	uint64_t _cycleBudgetEnd;
+	uint64_t _writeCount;
+
+	Recompiler _recompiler;
+
+	std::function<void(const WatchpointHit&)> _watchpointHandler;
 
 	unsigned char GetNextProgramByte()
 	{
+		if (_decodedOperand != nullptr)
+		{
+			++_registers.PC;
+			return *_decodedOperand++;
+		}
+
 		auto result = ReadByte(_registers.PC);
 
 		if (!_skipNextPCIncrement) ++_registers.PC;
@@ -116,8 +219,48 @@ protected:
 		return result;
 	}
 
+	// Fetches the next opcode from the decoded block cache, falling back to memory for code that isn't cached.
+	// Returns the threaded engine's dispatch id, which may be that of a fused handler starting with the opcode
+	unsigned short FetchDecodedOpcode()
+	{
+		auto pc = _registers.PC;
+
+		if (_nextDecoded == _decodedEnd || _nextDecoded->Address != pc)
+		{
+			// The byte after a HALT affected by the halt bug is read twice, so it isn't served from the cache
+			auto block = _skipNextPCIncrement ? nullptr : _blockCache.GetBlock(pc);
+
+			if (block == nullptr)
+			{
+				_nextDecoded = _decodedEnd = nullptr;
+				_decodedOperand = nullptr;
+				return GetNextProgramByte();
+			}
+
+			_nextDecoded = block->Instructions.data();
+			_decodedEnd = _nextDecoded + block->Instructions.size();
+		}
+
+		auto& instruction = *_nextDecoded++;
+		_registers.PC = pc + 1;
+		_decodedOperand = instruction.Operands;
+
+		return instruction.Handler;
+	}
+
+	void ResetDecodedBlock()
+	{
+		_nextDecoded = _decodedEnd = nullptr;
+		_decodedOperand = nullptr;
+	}
+
 	unsigned char GetByteOperand() { return GetNextProgramByte(); }
-	unsigned short GetWordOperand() { return GetByteOperand() | GetByteOperand() << 8; }
+	unsigned short GetWordOperand()
+	{
+		// Operand bytes are consumed in order, so the two reads must be sequenced
+		unsigned short word = GetByteOperand();
+		return word | GetByteOperand() << 8;
+	}
 
 	void PushWord(unsigned short word)
 	{
@@ -174,7 +317,7 @@ protected:
 		}
 	}
 
-	unsigned short Cpu::AddSpImm()
+	unsigned short AddSpImm()
 	{
 		auto offset = GetByteOperand();
 
@@ -202,40 +345,29 @@ protected:
 		return *_regRefs2[opcode & 0x7];
 	}
 
+	// Interrupt registers are mapped into the bus's I/O ports by the constructor
 	unsigned char ReadByte(unsigned short address) const
 	{
-		switch (address)
-		{
-		case WaitingInterruptsAddress:
-			return _waitingInterrupts | 0xe0;
-
-		case EnabledInterruptsAddress:
-			return _enabledInterrupts ;
-
-		default:
-			return _memoryMap.ReadByte(address);
-		}
+		return _memoryMap.ReadByte(address);
 	}
 
 	void WriteByte(unsigned short address, unsigned char value)
 	{
-		// TODO: Not great that every memory write pays the cost of checking whether interrupt
-		// registers are being updated. Could move this to the memory map address decoder and
-		// have it notify the CPU to check interrupts on the next instruction
-		switch (address)
-		{
-		case EnabledInterruptsAddress:
-			_enabledInterrupts = value & InterruptFlags::AllInt;
-			_interruptCheckRequired = true;
-			break;
+		++_writeCount;
 
-		case WaitingInterruptsAddress:
-			_waitingInterrupts = value & InterruptFlags::AllInt;
-			_interruptCheckRequired = true;
-			break;
+		_memoryMap.WriteByte(address, value);
 
-		default:
-			_memoryMap.WriteByte(address, value);
+		// Writes to the cartridge's control registers can bank switch the code being run (as can disabling
+		// the internal ROM, or OAM DMA blocking it), and writes to RAM-resident code make its decoded blocks stale
+		if (address < Bus::RamVideo || address == Bus::InternalRomDisable || address == Bus::OamDmaPort)
+		{
+			_nextDecoded = _decodedEnd = nullptr;
+			_codeRemapped = true;
+		}
+		else if (_blockCache.IsRamCode(address))
+		{
+			_blockCache.InvalidateRamBlocks();
+			_nextDecoded = _decodedEnd = nullptr;
 		}
 	}
 
@@ -332,18 +464,139 @@ protected:
 
 	int InvalidOp(unsigned char opcode);
 
+	// Compile-time specialised counterparts of the handlers above, instantiated once per opcode
+	// by the threaded engine. Defined in CpuSpecialisedOps.h
+	template<int Index> unsigned char& Reg8();
+	template<int Index> unsigned char ReadOperand8();
+	template<int Index> void WriteOperand8(unsigned char value);
+	template<int Index> unsigned short& Reg16Sp();
+	template<int Index> unsigned short& Reg16Af();
+	template<int Condition> bool ConditionMet() const;
+	template<int Operation> void Alu8(unsigned char src);
+
+	void SetLazyFlags(FlagOp op, unsigned char operand1, unsigned char operand2, unsigned char result, bool carry);
+	void SetFlags(unsigned char flags);
+	bool ZeroFlagSet() const;
+	bool CarryFlagSet() const;
+
+	// Brings F up to date with any lazily evaluated flags
+	void MaterialiseFlags();
+
+	// Called by the specialised handlers on taking a backward jump to target, taking jumpCycles. Returns the cycles of
+	// whole loop iterations skipped if the loop has been found to spin without side effects
+	int SkipIdleLoop(unsigned short target, int jumpCycles);
+
+	template<unsigned char Opcode> int Nop();
+	template<unsigned char Opcode> int Ld16RegImm();
+	template<unsigned char Opcode> int St8MemRegAcc();
+	template<unsigned char Opcode> int Inc16Reg();
+	template<unsigned char Opcode> int Dec16Reg();
+	template<unsigned char Opcode> int IncDec8RegOrMem();
+	template<unsigned char Opcode> int Ld8RegOrMemImm();
+	template<unsigned char Opcode> int Rlca();
+	template<unsigned char Opcode> int Rla();
+	template<unsigned char Opcode> int Rrca();
+	template<unsigned char Opcode> int Rra();
+	template<unsigned char Opcode> int St16MemSp();
+	template<unsigned char Opcode> int Add16RegReg();
+	template<unsigned char Opcode> int Ld8AccMem();
+	template<unsigned char Opcode> int Stop();
+	template<unsigned char Opcode> int Jr();
+	template<unsigned char Opcode> int Daa();
+	template<unsigned char Opcode> int Cpl();
+	template<unsigned char Opcode> int Scf();
+	template<unsigned char Opcode> int Ccf();
+	template<unsigned char Opcode> int Ld8RegOrMemRegOrMem();
+	template<unsigned char Opcode> int Halt();
+	template<unsigned char Opcode> int AluOp8AccRegOrMem();
+	template<unsigned char Opcode> int Di();
+	template<unsigned char Opcode> int Ei();
+	template<unsigned char Opcode> int Ret();
+	template<unsigned char Opcode> int Push16Reg();
+	template<unsigned char Opcode> int Pop16Reg();
+	template<unsigned char Opcode> int Jp();
+	template<unsigned char Opcode> int Call();
+	template<unsigned char Opcode> int AluOp8AccImm();
+	template<unsigned char Opcode> int Rst();
+	template<unsigned char Opcode> int St8HiMemImmAcc();
+	template<unsigned char Opcode> int St8HiMemCAcc();
+	template<unsigned char Opcode> int Ld8AccHiMemImm();
+	template<unsigned char Opcode> int Ld8AccHiMemC();
+	template<unsigned char Opcode> int Add8SpImm();
+	template<unsigned char Opcode> int Ld16HlSpImm();
+	template<unsigned char Opcode> int JpHl();
+	template<unsigned char Opcode> int Ld8AccMemImm();
+	template<unsigned char Opcode> int St8MemImmAcc();
+	template<unsigned char Opcode> int Ld16SpHl();
+	template<unsigned char Opcode> int PrefixCb();
+	template<unsigned char Opcode> int InvalidOp();
+
+	// Runs the specialised handler for an opcode that has already been fetched
+	template<unsigned char Opcode> int Execute();
+
+	// Fused handlers for opcode sequences from CPU_FUSED_TABLE, with the first opcode already fetched. Each
+	// following instruction only runs if the one before leaves the threaded dispatcher's fast path open
+	template<unsigned char Opcode> int RunFused();
+	template<unsigned char First, unsigned char Second, unsigned char... Rest> int RunFused();
+
+	// Handler for a single CB-prefixed opcode, and the table of them indexed by the byte following 0xcb
+	template<unsigned char CbOpcode> int CbOp();
+
+	template<std::size_t... CbOpcodes>
+	static std::array<int(CpuCore::*)(), 256> MakeSpecialisedCbOps(std::index_sequence<CbOpcodes...>);
+
+	static const std::array<int(CpuCore::*)(), 256> _specialisedCbOps;
+
+	// Runs one decoded instruction on behalf of native code compiled by _recompiler, and the table of them by opcode
+	template<unsigned char Opcode, int(CpuCore::*Handler)()>
+	static int RecompiledStep(void* cpu, const DecodedInstruction* instruction);
+
+	static const std::array<Recompiler::StepFunction, 256> _recompiledSteps;
+
+	Recompiler::CpuLayout GetRecompilerLayout() const;
+
+	// Cycles a halted/stopped CPU spends idling through cycleBudget, in whole machine cycles
+	static int IdleCycles(int cycleBudget) { return (cycleBudget + OneCycle - 1) / OneCycle * OneCycle; }
+
+	// Executes the next instruction through _opcodeJumpTable
+	int StepJumpTable();
+
+	// Executes instructions through the threaded dispatcher until at least cycleBudget cycles have elapsed.
+	// When Recompiling, blocks are run through compiled code instead once _recompiler has it for them
+	template<bool Recompiling> int RunThreaded(int cycleBudget);
+
 public:
-	explicit Cpu(MemoryMap& memory);
+	explicit CpuCore(Bus& memory);
 
 	bool IsClockRunning() const	{ return _state == CpuState::Running; }
 
+	CpuEngine GetEngine() const { return _engine; }
+	void SetEngine(CpuEngine engine) { _engine = engine; }
+
 	// Gets the total number of elapsed emulated CPU cycles (does not count when CPU is stopped/halted)
 	uint64_t GetTotalCycles() const { return _totalCycles; }
 
 	// Simulates an IRQ
 	void RequestInterrupt(InterruptFlags interruptFlags);
 
+	// Discards all decoded code, e.g. after the ROM image has been patched
+	void FlushDecodedCode();
+
+	// Calls handler for each access to an address watched through the bus's AddWatchpoint. Only accesses
+	// to pages with a watchpoint are checked, so memory without any runs at full speed
+	void SetWatchpointHandler(std::function<void(const WatchpointHit&)> handler);
+
 	// Executes the next emulated CPU instruction. Returns emulated CPU cycles elapsed
 	int DoNextInstruction();
+
+	// Executes instructions until at least cycleBudget emulated CPU cycles have elapsed. Returns emulated CPU cycles elapsed
+	int RunCycles(int cycleBudget);
+
+	// Executes instructions until currentCycle reaches cycleTarget, advancing currentCycle by the emulated CPU cycles elapsed
+	void RunUntil(int& currentCycle, int cycleTarget)
+	{
+		if (currentCycle < cycleTarget) currentCycle += RunCycles(cycleTarget - currentCycle);
+	}
 };
 
+extern template class CpuCore<MemoryMap>;
@@ -0,0 +1,8 @@
+#pragma once
+
+// Forward declaration of the CPU for components that only hold a reference or pointer to it
+template<typename Bus> class CpuCore;
+class MemoryMap;
+
+// CPU wired to the production memory map
+using Cpu = CpuCore<MemoryMap>;
@@ -0,0 +1,1042 @@
+#pragma once
+#include "Cpu.h"
+#include "CpuOpcodeTable.h"
+#include "CpuSpecialisedOps.h"
+#include <iostream>
+#include <algorithm>
+
+// Member definitions of CpuCore. Included only by the translation units that instantiate it for a bus
+
+template<typename Bus>
+const std::array<int(CpuCore<Bus>::*)(), 256> CpuCore<Bus>::_specialisedCbOps = MakeSpecialisedCbOps(std::make_index_sequence<256>());
+
+template<typename Bus>
+CpuCore<Bus>::CpuCore(Bus& memory) :
+	_memoryMap(memory), _state(CpuState::Running), _engine(CpuEngine::Threaded), _totalCycles(0), _extraCyclesConsumed(0), _skipNextPCIncrement(false),
+	_interruptsEnabled(true), _enabledInterrupts(InterruptFlags::NoInt), _waitingInterrupts(InterruptFlags::NoInt),
+	_interruptCheckRequired(false),
+	_flagOp(FlagOp::None), _flagOperand1(0), _flagOperand2(0), _flagResult(0), _flagCarry(false),
+	_aluOps
+	{
+		// ADD
+		[](unsigned char& dest, unsigned char src, bool carry)
+		{
+			auto res = dest + src;
+			unsigned char flags = res > 0xff ? CarryFlag : NoFlags;
+			flags |= (dest & 0xf) + (src & 0xf) > 0xf ? HalfCarryFlag : NoFlags;
+			dest = static_cast<unsigned char>(res);
+
+			return static_cast<unsigned char>(flags | (dest == 0 ? ZeroFlag : NoFlags));
+		},
+
+		// ADC
+		[](unsigned char& dest, unsigned char src, bool carry)
+		{
+			auto carryOffset = (carry ? 1 : 0);
+			auto res = dest + src + carryOffset;
+			unsigned char flags = res > 0xff ? CarryFlag : NoFlags;
+			flags |= (dest & 0xf) + (src & 0xf) + carryOffset > 0xf ? HalfCarryFlag : NoFlags;
+			dest = static_cast<unsigned char>(res);
+
+			return static_cast<unsigned char>(flags | (dest == 0 ? ZeroFlag : NoFlags));
+		},
+
+		// SUB
+		[](unsigned char& dest, unsigned char src, bool carry)
+		{
+			auto res = dest - src;
+			unsigned char flags = SubFlag | (res < 0 ? CarryFlag : NoFlags);
+			flags |= (dest & 0xf) - (src & 0xf) < 0 ? HalfCarryFlag : NoFlags;
+			dest = static_cast<unsigned char>(res);
+
+			return static_cast<unsigned char>(flags | (dest == 0 ? ZeroFlag : NoFlags));
+		},
+
+		// SBC
+		[](unsigned char& dest, unsigned char src, bool carry)
+		{
+			auto carryOffset = (carry ? 1 : 0);
+			auto res = dest - src - carryOffset;
+			unsigned char flags = SubFlag | (res < 0 ? CarryFlag : NoFlags);
+			flags |= (dest & 0xf) - (src & 0xf) - carryOffset < 0 ? HalfCarryFlag : NoFlags;
+			dest = static_cast<unsigned char>(res);
+
+			return static_cast<unsigned char>(flags | (dest == 0 ? ZeroFlag : NoFlags));
+		},
+
+		// AND
+		[](unsigned char& dest, unsigned char src, bool carry)
+		{
+			dest &= src;
+			return static_cast<unsigned char>(HalfCarryFlag | (dest == 0 ? ZeroFlag : NoFlags));
+		},
+
+		// XOR
+		[](unsigned char& dest, unsigned char src, bool carry)
+		{
+			dest ^= src;
+			return static_cast<unsigned char>(dest == 0 ? ZeroFlag : NoFlags);
+		},
+
+		// OR
+		[](unsigned char& dest, unsigned char src, bool carry)
+		{
+			dest |= src;
+			return static_cast<unsigned char>(dest == 0 ? ZeroFlag : NoFlags);
+		},
+
+		// CP
+		[](unsigned char& dest, unsigned char src, bool carry)
+		{
+			auto res = dest - src;
+			unsigned char flags = SubFlag | (res < 0 ? CarryFlag : NoFlags);
+			flags |= (dest & 0xf) - (src & 0xf) < 0 ? HalfCarryFlag : NoFlags;
+
+			return static_cast<unsigned char>(flags | (res == 0 ? ZeroFlag : NoFlags));
+		}
+	},
+	_prefixCbOps
+	{
+		// RLC
+		[](unsigned char& dest, unsigned char& flags)
+		{
+			dest = _rotl8(dest, 1);
+			flags = dest & 0x1 ? CarryFlag : NoFlags;
+		},
+
+		// RRC
+		[](unsigned char& dest, unsigned char& flags)
+		{
+			dest = _rotr8(dest, 1);
+			flags = dest & 0x80 ? CarryFlag : NoFlags;
+		},
+
+		// RL
+		[](unsigned char& dest, unsigned char& flags)
+		{
+			unsigned char tmp = (flags & CarryFlag) >> 4;
+			flags = (dest & 0x80) >> 3;
+			dest = dest << 1 | tmp;
+		},
+
+		// RR
+		[](unsigned char& dest, unsigned char& flags)
+		{
+			unsigned char tmp = (flags & CarryFlag) << 3;
+			flags = (dest & 0x1) << 4;
+			dest = dest >> 1 | tmp;
+		},
+
+		// SLA
+		[](unsigned char& dest, unsigned char& flags)
+		{
+			flags = (dest & 0x80) >> 3;
+			dest <<= 1;
+		},
+
+		// SRA
+		[](unsigned char& dest, unsigned char& flags)
+		{
+			flags = (dest & 0x1) << 4;
+			dest = dest >> 1 | (dest & 0x80);
+		},
+
+		// SWAP
+		[](unsigned char& dest, unsigned char& flags)
+		{
+			dest = _rotl8(dest, 4);
+			flags = NoFlags;
+		},
+
+		// SRL
+		[](unsigned char& dest, unsigned char& flags)
+		{
+			flags = (dest & 0x1) << 4;
+			dest >>= 1;
+		},
+
+#define BIT_OP_IMP(n) [](unsigned char& dest, unsigned char& flags) {\
+						flags = (flags & CarryFlag) | HalfCarryFlag | (dest & (0x1 << n) ? NoFlags : ZeroFlag);\
+					  }
+		// BIT
+		BIT_OP_IMP(0),
+		BIT_OP_IMP(1),
+		BIT_OP_IMP(2),
+		BIT_OP_IMP(3),
+		BIT_OP_IMP(4),
+		BIT_OP_IMP(5),
+		BIT_OP_IMP(6),
+		BIT_OP_IMP(7),
+
+
+#define RES_OP_IMP(n) [](unsigned char& dest, unsigned char& flags) { dest &= ~(0x1 << n); }
+
+		// RES
+		RES_OP_IMP(0),
+		RES_OP_IMP(1),
+		RES_OP_IMP(2),
+		RES_OP_IMP(3),
+		RES_OP_IMP(4),
+		RES_OP_IMP(5),
+		RES_OP_IMP(6),
+		RES_OP_IMP(7),
+
+
+#define SET_OP_IMP(n) [](unsigned char& dest, unsigned char& flags) { dest |= 0x1 << n; }
+
+		// SET
+		SET_OP_IMP(0),
+		SET_OP_IMP(1),
+		SET_OP_IMP(2),
+		SET_OP_IMP(3),
+		SET_OP_IMP(4),
+		SET_OP_IMP(5),
+		SET_OP_IMP(6),
+		SET_OP_IMP(7),
+	},
+	_opcodeJumpTable
+	{
+#define JUMP_TABLE_ENTRY(op, handler) &CpuCore::handler,
+		CPU_OPCODE_TABLE(JUMP_TABLE_ENTRY)
+#undef JUMP_TABLE_ENTRY
+	},
+	_blockCache(memory), _nextDecoded(nullptr), _decodedEnd(nullptr), _decodedOperand(nullptr),
+	_codeRemapped(false), _loopSnapshot(), _loopSnapshotValid(false), _cycleBudgetEnd(0), _writeCount(0),
+	_recompiler(_recompiledSteps, GetRecompilerLayout())
+{
+	memory.SetCycleCounter(&_totalCycles);
+
+	memory.MapIoPort(Bus::InterruptFlagPort, this,
+		[](void* cpu, unsigned short address) -> unsigned char { return static_cast<CpuCore*>(cpu)->_waitingInterrupts | 0xe0; },
+		[](void* cpu, unsigned short address, unsigned char value)
+		{
+			static_cast<CpuCore*>(cpu)->_waitingInterrupts = value & InterruptFlags::AllInt;
+			static_cast<CpuCore*>(cpu)->_interruptCheckRequired = true;
+		});
+
+	memory.MapIoPort(Bus::InterruptEnablePort, this,
+		[](void* cpu, unsigned short address) { return static_cast<CpuCore*>(cpu)->_enabledInterrupts; },
+		[](void* cpu, unsigned short address, unsigned char value)
+		{
+			static_cast<CpuCore*>(cpu)->_enabledInterrupts = value & InterruptFlags::AllInt;
+			static_cast<CpuCore*>(cpu)->_interruptCheckRequired = true;
+		});
+}
+
+template<typename Bus>
+void CpuCore<Bus>::SetWatchpointHandler(std::function<void(const WatchpointHit&)> handler)
+{
+	_watchpointHandler = std::move(handler);
+
+	_memoryMap.SetWatchHandler(this, [](void* cpu, unsigned short address, unsigned char value, WatchAccess access)
+	{
+		auto& self = *static_cast<CpuCore*>(cpu);
+		if (self._watchpointHandler) self._watchpointHandler({ address, value, access, self._registers.PC, self._totalCycles });
+	});
+}
+
+template<typename Bus>
+bool CpuCore<Bus>::ConditionMet(unsigned char opcode) const
+{
+	unsigned char condition = opcode & 0x10 ? CarryFlag : ZeroFlag;
+	auto invert = (opcode & 0x8) == 0;
+
+	return ((_registers.F & condition) != 0) ^ invert;
+}
+
+template<typename Bus>
+bool CpuCore<Bus>::InterruptTriggered()
+{
+	auto pendingInterrupts = _waitingInterrupts & _enabledInterrupts;
+	auto interruptTriggered = _interruptsEnabled && pendingInterrupts;
+
+	if (interruptTriggered)
+	{
+		_interruptsEnabled = false;
+
+		auto entry = std::find_if(_intVectors.begin(), _intVectors.end(), [pendingInterrupts]
+					(const std::pair<InterruptFlags, unsigned char>& e){ return pendingInterrupts & e.first; });
+
+		_waitingInterrupts ^= entry->first;
+
+		PushWord(_registers.PC);
+		_registers.PC = entry->second;
+	}
+
+	return interruptTriggered;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Nop(unsigned char opcode)
+{
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ld16RegImm(unsigned char opcode)
+{
+	GetReg16Ref1(opcode) = GetWordOperand();
+	return ThreeCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::St8MemRegAcc(unsigned char opcode)
+{
+	auto& ref = GetReg16Ref2(opcode);
+	WriteByte(ref, _registers.A);
+
+	switch (opcode & 0x30)
+	{
+	case 0x20:
+		ref++;
+		break;
+	case 0x30:
+		ref--;
+		break;
+	}
+
+	return TwoCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Inc16Reg(unsigned char opcode)
+{
+	GetReg16Ref1(opcode)++;
+	return TwoCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Dec16Reg(unsigned char opcode)
+{
+	GetReg16Ref1(opcode)--;
+	return TwoCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::IncDec8RegOrMem(unsigned char opcode)
+{
+	auto inc = !(opcode & 1);
+	auto cycleCount = OneCycle;
+	unsigned char flags = _registers.F & CarryFlag;
+	unsigned char newData;
+
+	if ((opcode & 0x38) != 0x30)
+	{
+		auto& reg = GetReg8Ref1(opcode);
+		newData = inc ? ++reg : --reg;
+	}
+	else
+	{
+		newData = ReadByte(_registers.HL);
+		WriteByte(_registers.HL, inc ? ++newData : --newData);
+		cycleCount = ThreeCycles;
+	}
+
+	flags |= newData == 0 ? ZeroFlag : NoFlags;
+	flags |= inc ? 0 : SubFlag;
+	_registers.F = flags | (inc && (newData & 0xf) == 0 || !inc && (newData & 0xf) == 0xf ? HalfCarryFlag : NoFlags);
+
+	return cycleCount;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ld8RegOrMemImm(unsigned char opcode)
+{
+	auto operand = GetByteOperand();
+
+	if ((opcode & 0x38) != 0x30)
+	{
+		GetReg8Ref1(opcode) = operand;
+		return TwoCycles;
+	}
+
+	WriteByte(_registers.HL, operand);
+	return ThreeCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Rlca(unsigned char opcode)
+{
+	auto newAcc = _rotl8(_registers.A, 1);
+	_registers.A = newAcc;
+	_registers.F = newAcc & 1 ? CarryFlag : NoFlags;
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Rla(unsigned char opcode)
+{
+	auto newAcc = _registers.A << 1;
+	_registers.A = static_cast<unsigned char>(newAcc | (_registers.F & 0x10) >> 4);
+	_registers.F = (newAcc & 0x100) >> 4;
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Rrca(unsigned char opcode)
+{
+	auto newVal = _rotr8(_registers.A, 1);
+	_registers.A = newVal;
+	_registers.F = newVal & 0x80 ? CarryFlag : NoFlags;
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Rra(unsigned char opcode)
+{
+	auto newFlags = (_registers.A & 1) << 4;
+	_registers.A = static_cast<unsigned char>(_registers.A >> 1 | (_registers.F & 0x10) << 3);
+	_registers.F = newFlags;
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::St16MemSp(unsigned char opcode)
+{
+	auto address = GetWordOperand();
+	WriteByte(address++, _registers.SP & 0xff);
+	WriteByte(address, _registers.SP >> 8);
+	return FiveCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Add16RegReg(unsigned char opcode)
+{
+	auto& regRef = GetReg16Ref1(opcode);
+	auto res = _registers.HL + regRef;
+
+	unsigned char flags = _registers.F & ZeroFlag | (res & 0x10000 ? CarryFlag : NoFlags);
+	flags |= (_registers.HL & 0xfff) + (regRef & 0xfff) & 0x1000 ? HalfCarryFlag : NoFlags;
+
+	_registers.HL = static_cast<unsigned short>(res);
+	_registers.F = flags;
+
+	return TwoCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ld8AccMem(unsigned char opcode)
+{
+	auto& ref = GetReg16Ref2(opcode);
+	_registers.A = ReadByte(ref);
+
+	switch (opcode & 0x30)
+	{
+	case 0x20:
+		ref++;
+		break;
+	case 0x30:
+		ref--;
+		break;
+	}
+
+	return TwoCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Stop(unsigned char opcode)
+{
+	//_state = CpuState::Stopped;
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Jr(unsigned char opcode)
+{
+	auto condition = (opcode & 0x10) != 0 ? CarryFlag : ZeroFlag;
+	auto invert = (opcode & 0x8) == 0;
+	auto offset = static_cast<char>(GetByteOperand());
+	auto cycleCount = TwoCycles;
+
+	if (opcode == 0x18 || ((_registers.F & condition) != 0) ^ invert)
+	{
+		_registers.PC += offset;
+		cycleCount = ThreeCycles;
+	}
+
+	return cycleCount;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Daa(unsigned char opcode)
+{
+	int accValue = _registers.A;
+	auto flags = _registers.F & SubFlag;
+
+	if (flags)
+	{
+		if (_registers.F & HalfCarryFlag) accValue = (accValue - 6) & 0xff;
+		if (_registers.F & CarryFlag) accValue -= 0x60;
+	}
+	else
+	{
+		if (_registers.F & HalfCarryFlag || (accValue & 0xf) > 9) accValue += 0x06;
+		if (_registers.F & CarryFlag || accValue > 0x9f) accValue += 0x60;
+	}
+
+	// Carry maintained if it was set before DAA was executed
+	if (accValue & 0x100 || _registers.F & CarryFlag) flags |= CarryFlag;
+
+	accValue &= 0xff;
+	if (accValue == 0) flags |= ZeroFlag;
+
+	_registers.A = accValue;
+	_registers.F = flags;
+
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Cpl(unsigned char opcode)
+{
+	_registers.A = ~_registers.A;
+	_registers.F |= SubFlag | HalfCarryFlag;
+
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Scf(unsigned char opcode)
+{
+	_registers.F = _registers.F & ZeroFlag | CarryFlag;
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ccf(unsigned char opcode)
+{
+	_registers.F = _registers.F & (ZeroFlag | CarryFlag) ^ CarryFlag;
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ld8RegOrMemRegOrMem(unsigned char opcode)
+{
+	unsigned char val;
+	auto cycleCount = OneCycle;
+
+	if ((opcode & 0x7) != 0x6)
+	{
+		val = GetReg8Ref2(opcode);
+	}
+	else
+	{
+		val = ReadByte(_registers.HL);
+		cycleCount = TwoCycles;
+	}
+
+	if ((opcode & 0x78) != 0x70)
+	{
+		GetReg8Ref1(opcode) = val;
+	}
+	else
+	{
+		WriteByte(_registers.HL, val);
+		cycleCount = TwoCycles;
+	}
+
+	return cycleCount;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Halt(unsigned char opcode)
+{
+	// Hardware bug that causes no halt and next PC increment to be skipped
+	if (!_interruptsEnabled & (_waitingInterrupts & _enabledInterrupts)) _skipNextPCIncrement = true;
+	else _state = CpuState::Halted;
+
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::AluOp8AccRegOrMem(unsigned char opcode)
+{
+	auto cycleCount = OneCycle;
+	unsigned char operand1;
+
+	if ((opcode & 0x7) != 0x6)
+	{
+		operand1 = GetReg8Ref2(opcode);
+	}
+	else
+	{
+		operand1 = ReadByte(_registers.HL);
+		cycleCount = TwoCycles;
+	}
+
+	_registers.F = _aluOps[(opcode & 0x38) >> 3](_registers.A, operand1, (_registers.F & CarryFlag) != 0);
+
+	return cycleCount;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Di(unsigned char opcode)
+{
+	_interruptsEnabled = false;
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ei(unsigned char opcode)
+{
+	// TODO: GB CPU enables interrupts after the instruction following this one
+	_interruptsEnabled = true;
+	_interruptCheckRequired = true;
+
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ret(unsigned char opcode)
+{
+	auto cycleCount = TwoCycles;
+
+	if ((opcode & 0x1) != 0 || ConditionMet(opcode))
+	{
+		_registers.PC = PopWord();
+		cycleCount = (opcode & 0x1) != 0 ? FourCycles : FiveCycles;
+
+		if (opcode == 0xd9) // RETI
+		{
+			Ei(opcode);
+		}
+	}
+
+	return cycleCount;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Push16Reg(unsigned char opcode)
+{
+	PushWord(GetReg16Ref3(opcode));
+	return FourCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Pop16Reg(unsigned char opcode)
+{
+	GetReg16Ref3(opcode) = PopWord();
+
+	// Ensure lower nibble of F is zero after possible pop into it
+	_registers.F &= 0xf0;
+
+	return ThreeCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Jp(unsigned char opcode)
+{
+	auto address = GetWordOperand();
+	auto cycleCount = ThreeCycles;
+
+	if (opcode == 0xc3 || ConditionMet(opcode))
+	{
+		_registers.PC = address;
+		cycleCount = FourCycles;
+	}
+
+	return cycleCount;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Call(unsigned char opcode)
+{
+	auto address = GetWordOperand();
+	auto cycleCount = ThreeCycles;
+
+	if (opcode == 0xcd || ConditionMet(opcode))
+	{
+		PushWord(_registers.PC);
+		_registers.PC = address;
+		cycleCount = SixCycles;
+	}
+
+	return cycleCount;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::AluOp8AccImm(unsigned char opcode)
+{
+	auto operand = GetByteOperand();
+	_registers.F = _aluOps[(opcode & 0x38) >> 3](_registers.A, operand, (_registers.F & CarryFlag) != 0);
+
+	return TwoCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Rst(unsigned char opcode)
+{
+	PushWord(_registers.PC);
+	_registers.PC = opcode - 0xc7;
+
+	return FourCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::St8HiMemImmAcc(unsigned char opcode)
+{
+	WriteByte(HiMemBaseAddress + GetByteOperand(), _registers.A);
+	return ThreeCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::St8HiMemCAcc(unsigned char opcode)
+{
+	WriteByte(HiMemBaseAddress + _registers.C, _registers.A);
+	return TwoCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ld8AccHiMemImm(unsigned char opcode)
+{
+	_registers.A = ReadByte(HiMemBaseAddress + GetByteOperand());
+	return ThreeCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ld8AccHiMemC(unsigned char opcode)
+{
+	_registers.A = ReadByte(HiMemBaseAddress + _registers.C);
+	return ThreeCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Add8SpImm(unsigned char opcode)
+{
+	_registers.SP = AddSpImm();
+	return FourCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ld16HlSpImm(unsigned char opcode)
+{
+	_registers.HL = AddSpImm();
+	return ThreeCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::JpHl(unsigned char opcode)
+{
+	_registers.PC = _registers.HL;
+	return OneCycle;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ld8AccMemImm(unsigned char opcode)
+{
+	_registers.A = ReadByte(GetWordOperand());
+	return FourCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::St8MemImmAcc(unsigned char opcode)
+{
+	WriteByte(GetWordOperand(), _registers.A);
+	return FourCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::Ld16SpHl(unsigned char opcode)
+{
+	_registers.SP = _registers.HL;
+	return TwoCycles;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::PrefixCb(unsigned char opcode)
+{
+	auto nextOpcode = GetNextProgramByte();
+
+	unsigned char val;
+	auto cycleCount = TwoCycles;
+	auto isReg = (nextOpcode & 0x7) != 0x6;
+
+	if (isReg)
+	{
+		val = GetReg8Ref2(nextOpcode);
+	}
+	else
+	{
+		val = ReadByte(_registers.HL);
+		cycleCount = FourCycles;
+	}
+
+	_prefixCbOps[nextOpcode >> 3](val, _registers.F);
+
+	// CB-prefixed opcodes >= 0x40 either don't update the zero flag, or
+	// else the/ op-specific logic called above already updates it
+	if (nextOpcode < 0x40)
+	{
+		_registers.F = _registers.F & ~ZeroFlag | (val == 0 ? ZeroFlag : NoFlags);
+	}
+
+	// Opcodes within this range don't write a result (other than flags)
+	if (nextOpcode < 0x40 || nextOpcode > 0x7f)
+	{
+		if (isReg)
+		{
+			GetReg8Ref2(nextOpcode) = val;
+		}
+		else
+		{
+			WriteByte(_registers.HL, val);
+		}
+	}
+
+	return cycleCount;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::InvalidOp(unsigned char opcode)
+{
+	std::cout << "Invalid opcode " << std::hex << opcode << " encountered" << std::endl;
+	throw std::exception("Invalid operation");
+}
+
+template<typename Bus>
+void CpuCore<Bus>::RequestInterrupt(InterruptFlags interruptFlags)
+{
+	_waitingInterrupts |= interruptFlags;
+
+	// Master interrupt enable is not required to wake from halt
+	if (_state == CpuState::Halted && _waitingInterrupts & _enabledInterrupts)
+	{
+		_state = CpuState::Running;
+		_extraCyclesConsumed = OneCycle;
+	}
+	else if (_state == CpuState::Stopped && interruptFlags & InterruptFlags::JoypadInt)
+	{
+		_state = CpuState::Running;
+
+		// GB hardware waits 2^16 cycles to let xtal oscillator stabilise
+		_extraCyclesConsumed = OneCycle * 65536;
+	}
+
+	_interruptCheckRequired = true;
+}
+
+template<typename Bus>
+int CpuCore<Bus>::StepJumpTable()
+{
+	if (_state != CpuState::Running) return OneCycle;
+
+	auto cycles = _extraCyclesConsumed;
+	_extraCyclesConsumed = 0;
+
+	if (_interruptCheckRequired)
+	{
+		// Interrupt takes five cycles per section 4.9 of
+		// https://github.com/AntonioND/giibiiadvance/blob/master/docs/TCAGBD.pdf
+		if (InterruptTriggered()) cycles += FiveCycles;
+		else _interruptCheckRequired = false;
+	}
+
+	if (cycles == 0)
+	{
+		auto opcode = GetNextProgramByte();
+
+		auto opPtr = _opcodeJumpTable[opcode];
+		cycles = (this->*opPtr)(opcode);
+	}
+
+	_totalCycles += cycles;
+	return cycles;
+}
+
+// GCC and Clang support taking the address of a label, which lets every handler end in its own indirect
+// jump to the next one. MSVC doesn't, so it gets a switch inside the loop instead
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_COMPUTED_GOTO
+#endif
+
+template<typename Bus>
+template<bool Recompiling>
+int CpuCore<Bus>::RunThreaded(int cycleBudget)
+{
+	auto cyclesRun = 0;
+	int cycles;
+	unsigned short handler;
+
+	// Memory outside the CPU's control may have changed since the last run, so loops must be seen to
+	// spin within this run before they're skipped
+	_loopSnapshotValid = false;
+	_cycleBudgetEnd = _totalCycles + cycleBudget;
+
+#ifdef CPU_COMPUTED_GOTO
+#define THREADED_LABEL_ADDRESS(op, handler) &&Op_##op,
+#define THREADED_FUSED_LABEL_ADDRESS(id, ...) &&Fused_##id,
+	static void* const dispatchTable[] = { CPU_OPCODE_TABLE(THREADED_LABEL_ADDRESS) CPU_FUSED_TABLE(THREADED_FUSED_LABEL_ADDRESS) };
+#undef THREADED_FUSED_LABEL_ADDRESS
+#undef THREADED_LABEL_ADDRESS
+#endif
+
+	while (cyclesRun < cycleBudget)
+	{
+		// Halted/stopped CPU can only be woken between calls, so it idles through the rest of the budget (not counted in total cycles)
+		if (_state != CpuState::Running)
+		{
+			cyclesRun += IdleCycles(cycleBudget - cyclesRun);
+			continue;
+		}
+
+		if (_interruptCheckRequired)
+		{
+			cycles = _extraCyclesConsumed;
+			_extraCyclesConsumed = 0;
+
+			if (InterruptTriggered()) cycles += FiveCycles;
+			else _interruptCheckRequired = false;
+
+			if (cycles != 0)
+			{
+				_totalCycles += cycles;
+				cyclesRun += cycles;
+				continue;
+			}
+		}
+
+		// Entering a new block, which may have been compiled
+		if (Recompiling && _nextDecoded == _decodedEnd && !_skipNextPCIncrement)
+		{
+			auto block = _blockCache.GetBlock(_registers.PC);
+			auto nativeCode = block != nullptr ? _recompiler.GetNativeCode(*block) : nullptr;
+
+			if (nativeCode != nullptr)
+			{
+				_codeRemapped = false;
+				cyclesRun += nativeCode(this, cycleBudget - cyclesRun);
+				ResetDecodedBlock();
+				continue;
+			}
+		}
+
+		handler = FetchDecodedOpcode();
+
+#ifdef CPU_COMPUTED_GOTO
+		goto *dispatchTable[handler];
+
+		// Each handler is specialised for its opcode (or sequence of them) and dispatches the next instruction
+		// itself unless the slow path above is needed
+#define THREADED_DISPATCH_NEXT \
+		_totalCycles += cycles; \
+		cyclesRun += cycles; \
+		if (cyclesRun < cycleBudget && !_interruptCheckRequired && _state == CpuState::Running && (!Recompiling || _nextDecoded != _decodedEnd)) \
+		{ \
+			handler = FetchDecodedOpcode(); \
+			goto *dispatchTable[handler]; \
+		} \
+		continue;
+
+#define THREADED_HANDLER(op, handlerName) Op_##op: cycles = handlerName<op>(); THREADED_DISPATCH_NEXT
+#define THREADED_FUSED_HANDLER(id, ...) Fused_##id: cycles = RunFused<__VA_ARGS__>(); THREADED_DISPATCH_NEXT
+
+		CPU_OPCODE_TABLE(THREADED_HANDLER)
+		CPU_FUSED_TABLE(THREADED_FUSED_HANDLER)
+#undef THREADED_FUSED_HANDLER
+#undef THREADED_HANDLER
+#undef THREADED_DISPATCH_NEXT
+#else
+		switch (handler)
+		{
+#define THREADED_CASE(op, handlerName) case op: cycles = handlerName<op>(); break;
+#define THREADED_FUSED_CASE(id, ...) case id: cycles = RunFused<__VA_ARGS__>(); break;
+			CPU_OPCODE_TABLE(THREADED_CASE)
+			CPU_FUSED_TABLE(THREADED_FUSED_CASE)
+#undef THREADED_FUSED_CASE
+#undef THREADED_CASE
+		}
+
+		_totalCycles += cycles;
+		cyclesRun += cycles;
+#endif
+	}
+
+	// Operands of the last instruction have been consumed. Clearing this keeps
+	// the jump table engine reading from memory if it's selected next
+	_decodedOperand = nullptr;
+
+	// Registers are up to date whenever control returns to the caller
+	MaterialiseFlags();
+
+	return cyclesRun;
+}
+
+template<typename Bus>
+template<unsigned char Opcode, int(CpuCore<Bus>::*Handler)()>
+int CpuCore<Bus>::RecompiledStep(void* cpuPointer, const DecodedInstruction* instruction)
+{
+	auto cpu = static_cast<CpuCore*>(cpuPointer);
+
+	cpu->_registers.PC = instruction->Address + 1;
+	cpu->_decodedOperand = instruction->Operands;
+
+	auto cycles = (cpu->*Handler)();
+	cpu->_totalCycles += cycles;
+	cpu->_decodedOperand = nullptr;
+
+	// Leave native code whenever the threaded dispatcher's slow path is needed, or the code being run may have been switched out
+	auto leaveBlock = cpu->_interruptCheckRequired || cpu->_state != CpuState::Running || cpu->_skipNextPCIncrement || cpu->_codeRemapped;
+
+	return leaveBlock ? ~cycles : cycles;
+}
+
+template<typename Bus>
+const std::array<Recompiler::StepFunction, 256> CpuCore<Bus>::_recompiledSteps =
+{{
+#define RECOMPILED_STEP(op, handler) &CpuCore::RecompiledStep<op, &CpuCore::handler<op>>,
+	CPU_OPCODE_TABLE(RECOMPILED_STEP)
+#undef RECOMPILED_STEP
+}};
+
+template<typename Bus>
+Recompiler::CpuLayout CpuCore<Bus>::GetRecompilerLayout() const
+{
+	auto base = reinterpret_cast<const char*>(this);
+	auto offset = [base](const void* member) { return static_cast<int>(static_cast<const char*>(member) - base); };
+
+	return
+	{
+		{{
+			offset(&_registers.B), offset(&_registers.C), offset(&_registers.D), offset(&_registers.E),
+			offset(&_registers.H), offset(&_registers.L), 0, offset(&_registers.A)
+		}},
+		offset(&_registers.PC),
+		offset(&_totalCycles)
+	};
+}
+
+template<typename Bus>
+void CpuCore<Bus>::FlushDecodedCode()
+{
+	_blockCache.Clear();
+	_recompiler.Clear();
+	ResetDecodedBlock();
+}
+
+template<typename Bus>
+int CpuCore<Bus>::DoNextInstruction()
+{
+	// A budget of a single cycle runs exactly one instruction (or interrupt dispatch/idle cycle)
+	switch (_engine)
+	{
+	case CpuEngine::Threaded: return RunThreaded<false>(1);
+	case CpuEngine::Recompiler: return RunThreaded<true>(1);
+	default: return StepJumpTable();
+	}
+}
+
+template<typename Bus>
+int CpuCore<Bus>::RunCycles(int cycleBudget)
+{
+	if (_engine == CpuEngine::Threaded) return RunThreaded<false>(cycleBudget);
+	if (_engine == CpuEngine::Recompiler) return RunThreaded<true>(cycleBudget);
+
+	auto cyclesRun = 0;
+
+	while (cyclesRun < cycleBudget)
+	{
+		cyclesRun += _state == CpuState::Running ? StepJumpTable() : IdleCycles(cycleBudget - cyclesRun);
+	}
+
+	return cyclesRun;
+}
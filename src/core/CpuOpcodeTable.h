@@ -0,0 +1,70 @@
+#pragma once
+
+// Maps every top-level opcode to the Cpu member that implements it. Expanded with OP(opcode, handler)
+// by each dispatch engine so that the jump table and threaded interpreter can't get out of step
+#define CPU_OPCODE_TABLE(OP) \
+	OP(0x00, Nop) OP(0x01, Ld16RegImm) OP(0x02, St8MemRegAcc) OP(0x03, Inc16Reg) OP(0x04, IncDec8RegOrMem) OP(0x05, IncDec8RegOrMem) OP(0x06, Ld8RegOrMemImm) OP(0x07, Rlca) \
+	OP(0x08, St16MemSp) OP(0x09, Add16RegReg) OP(0x0a, Ld8AccMem) OP(0x0b, Dec16Reg) OP(0x0c, IncDec8RegOrMem) OP(0x0d, IncDec8RegOrMem) OP(0x0e, Ld8RegOrMemImm) OP(0x0f, Rrca) \
+	\
+	OP(0x10, Stop) OP(0x11, Ld16RegImm) OP(0x12, St8MemRegAcc) OP(0x13, Inc16Reg) OP(0x14, IncDec8RegOrMem) OP(0x15, IncDec8RegOrMem) OP(0x16, Ld8RegOrMemImm) OP(0x17, Rla) \
+	OP(0x18, Jr) OP(0x19, Add16RegReg) OP(0x1a, Ld8AccMem) OP(0x1b, Dec16Reg) OP(0x1c, IncDec8RegOrMem) OP(0x1d, IncDec8RegOrMem) OP(0x1e, Ld8RegOrMemImm) OP(0x1f, Rra) \
+	\
+	OP(0x20, Jr) OP(0x21, Ld16RegImm) OP(0x22, St8MemRegAcc) OP(0x23, Inc16Reg) OP(0x24, IncDec8RegOrMem) OP(0x25, IncDec8RegOrMem) OP(0x26, Ld8RegOrMemImm) OP(0x27, Daa) \
+	OP(0x28, Jr) OP(0x29, Add16RegReg) OP(0x2a, Ld8AccMem) OP(0x2b, Dec16Reg) OP(0x2c, IncDec8RegOrMem) OP(0x2d, IncDec8RegOrMem) OP(0x2e, Ld8RegOrMemImm) OP(0x2f, Cpl) \
+	\
+	OP(0x30, Jr) OP(0x31, Ld16RegImm) OP(0x32, St8MemRegAcc) OP(0x33, Inc16Reg) OP(0x34, IncDec8RegOrMem) OP(0x35, IncDec8RegOrMem) OP(0x36, Ld8RegOrMemImm) OP(0x37, Scf) \
+	OP(0x38, Jr) OP(0x39, Add16RegReg) OP(0x3a, Ld8AccMem) OP(0x3b, Dec16Reg) OP(0x3c, IncDec8RegOrMem) OP(0x3d, IncDec8RegOrMem) OP(0x3e, Ld8RegOrMemImm) OP(0x3f, Ccf) \
+	\
+	OP(0x40, Ld8RegOrMemRegOrMem) OP(0x41, Ld8RegOrMemRegOrMem) OP(0x42, Ld8RegOrMemRegOrMem) OP(0x43, Ld8RegOrMemRegOrMem) OP(0x44, Ld8RegOrMemRegOrMem) OP(0x45, Ld8RegOrMemRegOrMem) OP(0x46, Ld8RegOrMemRegOrMem) OP(0x47, Ld8RegOrMemRegOrMem) \
+	OP(0x48, Ld8RegOrMemRegOrMem) OP(0x49, Ld8RegOrMemRegOrMem) OP(0x4a, Ld8RegOrMemRegOrMem) OP(0x4b, Ld8RegOrMemRegOrMem) OP(0x4c, Ld8RegOrMemRegOrMem) OP(0x4d, Ld8RegOrMemRegOrMem) OP(0x4e, Ld8RegOrMemRegOrMem) OP(0x4f, Ld8RegOrMemRegOrMem) \
+	\
+	OP(0x50, Ld8RegOrMemRegOrMem) OP(0x51, Ld8RegOrMemRegOrMem) OP(0x52, Ld8RegOrMemRegOrMem) OP(0x53, Ld8RegOrMemRegOrMem) OP(0x54, Ld8RegOrMemRegOrMem) OP(0x55, Ld8RegOrMemRegOrMem) OP(0x56, Ld8RegOrMemRegOrMem) OP(0x57, Ld8RegOrMemRegOrMem) \
+	OP(0x58, Ld8RegOrMemRegOrMem) OP(0x59, Ld8RegOrMemRegOrMem) OP(0x5a, Ld8RegOrMemRegOrMem) OP(0x5b, Ld8RegOrMemRegOrMem) OP(0x5c, Ld8RegOrMemRegOrMem) OP(0x5d, Ld8RegOrMemRegOrMem) OP(0x5e, Ld8RegOrMemRegOrMem) OP(0x5f, Ld8RegOrMemRegOrMem) \
+	\
+	OP(0x60, Ld8RegOrMemRegOrMem) OP(0x61, Ld8RegOrMemRegOrMem) OP(0x62, Ld8RegOrMemRegOrMem) OP(0x63, Ld8RegOrMemRegOrMem) OP(0x64, Ld8RegOrMemRegOrMem) OP(0x65, Ld8RegOrMemRegOrMem) OP(0x66, Ld8RegOrMemRegOrMem) OP(0x67, Ld8RegOrMemRegOrMem) \
+	OP(0x68, Ld8RegOrMemRegOrMem) OP(0x69, Ld8RegOrMemRegOrMem) OP(0x6a, Ld8RegOrMemRegOrMem) OP(0x6b, Ld8RegOrMemRegOrMem) OP(0x6c, Ld8RegOrMemRegOrMem) OP(0x6d, Ld8RegOrMemRegOrMem) OP(0x6e, Ld8RegOrMemRegOrMem) OP(0x6f, Ld8RegOrMemRegOrMem) \
+	\
+	OP(0x70, Ld8RegOrMemRegOrMem) OP(0x71, Ld8RegOrMemRegOrMem) OP(0x72, Ld8RegOrMemRegOrMem) OP(0x73, Ld8RegOrMemRegOrMem) OP(0x74, Ld8RegOrMemRegOrMem) OP(0x75, Ld8RegOrMemRegOrMem) OP(0x76, Halt) OP(0x77, Ld8RegOrMemRegOrMem) \
+	OP(0x78, Ld8RegOrMemRegOrMem) OP(0x79, Ld8RegOrMemRegOrMem) OP(0x7a, Ld8RegOrMemRegOrMem) OP(0x7b, Ld8RegOrMemRegOrMem) OP(0x7c, Ld8RegOrMemRegOrMem) OP(0x7d, Ld8RegOrMemRegOrMem) OP(0x7e, Ld8RegOrMemRegOrMem) OP(0x7f, Ld8RegOrMemRegOrMem) \
+	\
+	OP(0x80, AluOp8AccRegOrMem) OP(0x81, AluOp8AccRegOrMem) OP(0x82, AluOp8AccRegOrMem) OP(0x83, AluOp8AccRegOrMem) OP(0x84, AluOp8AccRegOrMem) OP(0x85, AluOp8AccRegOrMem) OP(0x86, AluOp8AccRegOrMem) OP(0x87, AluOp8AccRegOrMem) \
+	OP(0x88, AluOp8AccRegOrMem) OP(0x89, AluOp8AccRegOrMem) OP(0x8a, AluOp8AccRegOrMem) OP(0x8b, AluOp8AccRegOrMem) OP(0x8c, AluOp8AccRegOrMem) OP(0x8d, AluOp8AccRegOrMem) OP(0x8e, AluOp8AccRegOrMem) OP(0x8f, AluOp8AccRegOrMem) \
+	\
+	OP(0x90, AluOp8AccRegOrMem) OP(0x91, AluOp8AccRegOrMem) OP(0x92, AluOp8AccRegOrMem) OP(0x93, AluOp8AccRegOrMem) OP(0x94, AluOp8AccRegOrMem) OP(0x95, AluOp8AccRegOrMem) OP(0x96, AluOp8AccRegOrMem) OP(0x97, AluOp8AccRegOrMem) \
+	OP(0x98, AluOp8AccRegOrMem) OP(0x99, AluOp8AccRegOrMem) OP(0x9a, AluOp8AccRegOrMem) OP(0x9b, AluOp8AccRegOrMem) OP(0x9c, AluOp8AccRegOrMem) OP(0x9d, AluOp8AccRegOrMem) OP(0x9e, AluOp8AccRegOrMem) OP(0x9f, AluOp8AccRegOrMem) \
+	\
+	OP(0xa0, AluOp8AccRegOrMem) OP(0xa1, AluOp8AccRegOrMem) OP(0xa2, AluOp8AccRegOrMem) OP(0xa3, AluOp8AccRegOrMem) OP(0xa4, AluOp8AccRegOrMem) OP(0xa5, AluOp8AccRegOrMem) OP(0xa6, AluOp8AccRegOrMem) OP(0xa7, AluOp8AccRegOrMem) \
+	OP(0xa8, AluOp8AccRegOrMem) OP(0xa9, AluOp8AccRegOrMem) OP(0xaa, AluOp8AccRegOrMem) OP(0xab, AluOp8AccRegOrMem) OP(0xac, AluOp8AccRegOrMem) OP(0xad, AluOp8AccRegOrMem) OP(0xae, AluOp8AccRegOrMem) OP(0xaf, AluOp8AccRegOrMem) \
+	\
+	OP(0xb0, AluOp8AccRegOrMem) OP(0xb1, AluOp8AccRegOrMem) OP(0xb2, AluOp8AccRegOrMem) OP(0xb3, AluOp8AccRegOrMem) OP(0xb4, AluOp8AccRegOrMem) OP(0xb5, AluOp8AccRegOrMem) OP(0xb6, AluOp8AccRegOrMem) OP(0xb7, AluOp8AccRegOrMem) \
+	OP(0xb8, AluOp8AccRegOrMem) OP(0xb9, AluOp8AccRegOrMem) OP(0xba, AluOp8AccRegOrMem) OP(0xbb, AluOp8AccRegOrMem) OP(0xbc, AluOp8AccRegOrMem) OP(0xbd, AluOp8AccRegOrMem) OP(0xbe, AluOp8AccRegOrMem) OP(0xbf, AluOp8AccRegOrMem) \
+	\
+	OP(0xc0, Ret) OP(0xc1, Pop16Reg) OP(0xc2, Jp) OP(0xc3, Jp) OP(0xc4, Call) OP(0xc5, Push16Reg) OP(0xc6, AluOp8AccImm) OP(0xc7, Rst) \
+	OP(0xc8, Ret) OP(0xc9, Ret) OP(0xca, Jp) OP(0xcb, PrefixCb) OP(0xcc, Call) OP(0xcd, Call) OP(0xce, AluOp8AccImm) OP(0xcf, Rst) \
+	\
+	OP(0xd0, Ret) OP(0xd1, Pop16Reg) OP(0xd2, Jp) OP(0xd3, InvalidOp) OP(0xd4, Call) OP(0xd5, Push16Reg) OP(0xd6, AluOp8AccImm) OP(0xd7, Rst) \
+	OP(0xd8, Ret) OP(0xd9, Ret) OP(0xda, Jp) OP(0xdb, InvalidOp) OP(0xdc, Call) OP(0xdd, InvalidOp) OP(0xde, AluOp8AccImm) OP(0xdf, Rst) \
+	\
+	OP(0xe0, St8HiMemImmAcc) OP(0xe1, Pop16Reg) OP(0xe2, St8HiMemCAcc) OP(0xe3, InvalidOp) OP(0xe4, InvalidOp) OP(0xe5, Push16Reg) OP(0xe6, AluOp8AccImm) OP(0xe7, Rst) \
+	OP(0xe8, Add8SpImm) OP(0xe9, JpHl) OP(0xea, St8MemImmAcc) OP(0xeb, InvalidOp) OP(0xec, InvalidOp) OP(0xed, InvalidOp) OP(0xee, AluOp8AccImm) OP(0xef, Rst) \
+	\
+	OP(0xf0, Ld8AccHiMemImm) OP(0xf1, Pop16Reg) OP(0xf2, Ld8AccHiMemC) OP(0xf3, Di) OP(0xf4, InvalidOp) OP(0xf5, Push16Reg) OP(0xf6, AluOp8AccImm) OP(0xf7, Rst) \
+	OP(0xf8, Ld16HlSpImm) OP(0xf9, Ld16SpHl) OP(0xfa, Ld8AccMemImm) OP(0xfb, Ei) OP(0xfc, InvalidOp) OP(0xfd, InvalidOp) OP(0xfe, AluOp8AccImm) OP(0xff, Rst)
+
+// Opcode sequences the threaded engines run through a single fused handler, expanded with OP(handler id, opcodes...).
+// Ids follow on from the opcodes and must stay consecutive. Sequences may overlap: each block is covered by whichever
+// non-overlapping set of them fuses the most instructions (see DecodedBlockCache::FuseSequences)
+#define CPU_FUSED_TABLE(OP) \
+	OP(0x100, 0xf0, 0xfe, 0x20)	/* LDH A,(n) / CP n / JR NZ */ \
+	OP(0x101, 0xf0, 0xfe, 0x28)	/* LDH A,(n) / CP n / JR Z */ \
+	OP(0x102, 0x78, 0xb1, 0x20)	/* LD A,B / OR C / JR NZ */ \
+	OP(0x103, 0xfe, 0x20)		/* CP n / JR NZ */ \
+	OP(0x104, 0xfe, 0x28)		/* CP n / JR Z */ \
+	OP(0x105, 0x05, 0x20)		/* DEC B / JR NZ */ \
+	OP(0x106, 0x0d, 0x20)		/* DEC C / JR NZ */ \
+	OP(0x107, 0x1d, 0x20)		/* DEC E / JR NZ */ \
+	OP(0x108, 0x2a, 0x12)		/* LD A,(HL+) / LD (DE),A */ \
+	OP(0x109, 0x12, 0x13)		/* LD (DE),A / INC DE */ \
+	OP(0x10a, 0x0b, 0x78)		/* DEC BC / LD A,B */ \
+	OP(0x10b, 0x0b, 0x78, 0xb1, 0x20)	/* DEC BC / LD A,B / OR C / JR NZ */ \
+	OP(0x10c, 0x2a, 0x12, 0x13)	/* LD A,(HL+) / LD (DE),A / INC DE */
@@ -0,0 +1,783 @@
+#pragma once
+#include "Cpu.h"
+#include "CpuOpcodeTable.h"
+
+// Compile-time specialised opcode handlers. Each is instantiated once per opcode, so operand
+// selection, ALU operation, condition codes and cycle counts are constants the compiler folds away.
+// Their behaviour must match the runtime-decoding handlers in CpuImpl.h exactly
+
+template<typename Bus>
+template<int Index>
+unsigned char& CpuCore<Bus>::Reg8()
+{
+	// Register encoding used by opcode bits 0-2 and 3-5. Index 6 is (HL), which is never
+	// referenced through here - ReadOperand8/WriteOperand8 route it to memory instead
+	switch (Index)
+	{
+	case 0: return _registers.B;
+	case 1: return _registers.C;
+	case 2: return _registers.D;
+	case 3: return _registers.E;
+	case 4: return _registers.H;
+	case 5: return _registers.L;
+	default: return _registers.A;
+	}
+}
+
+template<typename Bus>
+template<int Index>
+unsigned char CpuCore<Bus>::ReadOperand8()
+{
+	return Index == IndirectHlIndex ? ReadByte(_registers.HL) : Reg8<Index>();
+}
+
+template<typename Bus>
+template<int Index>
+void CpuCore<Bus>::WriteOperand8(unsigned char value)
+{
+	if (Index == IndirectHlIndex) WriteByte(_registers.HL, value);
+	else Reg8<Index>() = value;
+}
+
+template<typename Bus>
+template<int Index>
+unsigned short& CpuCore<Bus>::Reg16Sp()
+{
+	switch (Index)
+	{
+	case 0: return _registers.BC;
+	case 1: return _registers.DE;
+	case 2: return _registers.HL;
+	default: return _registers.SP;
+	}
+}
+
+template<typename Bus>
+template<int Index>
+unsigned short& CpuCore<Bus>::Reg16Af()
+{
+	switch (Index)
+	{
+	case 0: return _registers.BC;
+	case 1: return _registers.DE;
+	case 2: return _registers.HL;
+	default: return _registers.AF;
+	}
+}
+
+template<typename Bus>
+template<int Condition>
+bool CpuCore<Bus>::ConditionMet() const
+{
+	// NZ, Z, NC, C
+	switch (Condition)
+	{
+	case 0: return !ZeroFlagSet();
+	case 1: return ZeroFlagSet();
+	case 2: return !CarryFlagSet();
+	default: return CarryFlagSet();
+	}
+}
+
+template<typename Bus>
+inline void CpuCore<Bus>::SetLazyFlags(FlagOp op, unsigned char operand1, unsigned char operand2, unsigned char result, bool carry)
+{
+	_flagOp = op;
+	_flagOperand1 = operand1;
+	_flagOperand2 = operand2;
+	_flagResult = result;
+	_flagCarry = carry;
+}
+
+template<typename Bus>
+inline void CpuCore<Bus>::SetFlags(unsigned char flags)
+{
+	_registers.F = flags;
+	_flagOp = FlagOp::None;
+}
+
+template<typename Bus>
+inline bool CpuCore<Bus>::ZeroFlagSet() const
+{
+	return _flagOp == FlagOp::None ? (_registers.F & ZeroFlag) != 0 : _flagResult == 0;
+}
+
+template<typename Bus>
+inline bool CpuCore<Bus>::CarryFlagSet() const
+{
+	switch (_flagOp)
+	{
+	case FlagOp::None: return (_registers.F & CarryFlag) != 0;
+	case FlagOp::Add: return _flagOperand1 + _flagOperand2 + _flagCarry > 0xff;
+	case FlagOp::Sub: return _flagOperand1 - _flagOperand2 - _flagCarry < 0;
+	case FlagOp::And:
+	case FlagOp::OrXor: return false;
+	default: return _flagCarry;
+	}
+}
+
+template<typename Bus>
+inline void CpuCore<Bus>::MaterialiseFlags()
+{
+	if (_flagOp == FlagOp::None) return;
+
+	unsigned char flags = (ZeroFlagSet() ? ZeroFlag : NoFlags) | (CarryFlagSet() ? CarryFlag : NoFlags);
+
+	switch (_flagOp)
+	{
+	case FlagOp::Add:
+		if ((_flagOperand1 & 0xf) + (_flagOperand2 & 0xf) + _flagCarry > 0xf) flags |= HalfCarryFlag;
+		break;
+
+	case FlagOp::Sub:
+		flags |= SubFlag;
+		if ((_flagOperand1 & 0xf) - (_flagOperand2 & 0xf) - _flagCarry < 0) flags |= HalfCarryFlag;
+		break;
+
+	case FlagOp::Inc:
+		if ((_flagResult & 0xf) == 0) flags |= HalfCarryFlag;
+		break;
+
+	case FlagOp::Dec:
+		flags |= SubFlag;
+		if ((_flagResult & 0xf) == 0xf) flags |= HalfCarryFlag;
+		break;
+
+	case FlagOp::And:
+	case FlagOp::Bit:
+		flags |= HalfCarryFlag;
+		break;
+
+	default:
+		break;
+	}
+
+	SetFlags(flags);
+}
+
+template<typename Bus>
+inline int CpuCore<Bus>::SkipIdleLoop(unsigned short target, int jumpCycles)
+{
+	// Every iteration's accesses must reach watchpoints, so nothing is skipped while any are set
+	if (_memoryMap.HasWatchpoints())
+	{
+		_loopSnapshotValid = false;
+		return 0;
+	}
+
+	auto& snapshot = _loopSnapshot;
+	auto skippedCycles = 0;
+
+	// The same loop head reached again with identical registers and no writes made in between. Neither
+	// interrupts nor the hardware the loop may be polling can change anything until the run ends, so every
+	// following iteration would do exactly the same
+	if (_loopSnapshotValid && snapshot.Target == target && snapshot.WriteCount == _writeCount &&
+		snapshot.LoopRegisters == _registers && snapshot.LoopFlagOp == _flagOp && snapshot.FlagOperand1 == _flagOperand1 &&
+		snapshot.FlagOperand2 == _flagOperand2 && snapshot.FlagResult == _flagResult && snapshot.FlagCarry == _flagCarry &&
+		snapshot.InterruptsEnabled == _interruptsEnabled && !_interruptCheckRequired)
+	{
+		auto iterationCycles = _totalCycles - snapshot.TotalCycles;
+
+		// Skip as many whole iterations as end within the budget, counting from the end of the jump
+		auto iterationsEnd = _totalCycles + jumpCycles;
+
+		if (iterationCycles != 0 && _cycleBudgetEnd > iterationsEnd)
+		{
+			skippedCycles = static_cast<int>((_cycleBudgetEnd - iterationsEnd) / iterationCycles * iterationCycles);
+		}
+	}
+
+	snapshot.Target = target;
+	snapshot.LoopRegisters = _registers;
+	snapshot.LoopFlagOp = _flagOp;
+	snapshot.FlagOperand1 = _flagOperand1;
+	snapshot.FlagOperand2 = _flagOperand2;
+	snapshot.FlagResult = _flagResult;
+	snapshot.FlagCarry = _flagCarry;
+	snapshot.InterruptsEnabled = _interruptsEnabled;
+	snapshot.WriteCount = _writeCount;
+	snapshot.TotalCycles = _totalCycles + skippedCycles;
+	_loopSnapshotValid = true;
+
+	return skippedCycles;
+}
+
+template<typename Bus>
+template<int Operation>
+void CpuCore<Bus>::Alu8(unsigned char src)
+{
+	auto& dest = _registers.A;
+	bool carry;
+	unsigned char res;
+
+	// ADD, ADC, SUB, SBC, AND, XOR, OR, CP. Flags are left for MaterialiseFlags to work out if they're needed
+	switch (Operation)
+	{
+	case 0:
+	case 1:
+		carry = Operation == 1 && CarryFlagSet();
+		res = static_cast<unsigned char>(dest + src + carry);
+		SetLazyFlags(FlagOp::Add, dest, src, res, carry);
+		dest = res;
+		break;
+
+	case 2:
+	case 3:
+	case 7:
+		carry = Operation == 3 && CarryFlagSet();
+		res = static_cast<unsigned char>(dest - src - carry);
+		SetLazyFlags(FlagOp::Sub, dest, src, res, carry);
+		if (Operation != 7) dest = res;
+		break;
+
+	case 4:
+		dest &= src;
+		SetLazyFlags(FlagOp::And, 0, 0, dest, false);
+		break;
+
+	case 5:
+		dest ^= src;
+		SetLazyFlags(FlagOp::OrXor, 0, 0, dest, false);
+		break;
+
+	default:
+		dest |= src;
+		SetLazyFlags(FlagOp::OrXor, 0, 0, dest, false);
+		break;
+	}
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Nop()
+{
+	return OneCycle;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ld16RegImm()
+{
+	Reg16Sp<(Opcode >> 4) & 0x3>() = GetWordOperand();
+	return ThreeCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::St8MemRegAcc()
+{
+	const int pair = (Opcode >> 4) & 0x3;
+	auto& ref = Reg16Sp<(pair < 2 ? pair : 2)>();
+	WriteByte(ref, _registers.A);
+
+	if (pair == 2) ref++;
+	else if (pair == 3) ref--;
+
+	return TwoCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Inc16Reg()
+{
+	Reg16Sp<(Opcode >> 4) & 0x3>()++;
+	return TwoCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Dec16Reg()
+{
+	Reg16Sp<(Opcode >> 4) & 0x3>()--;
+	return TwoCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::IncDec8RegOrMem()
+{
+	const int index = (Opcode >> 3) & 0x7;
+	const bool inc = !(Opcode & 1);
+
+	unsigned char newData = ReadOperand8<index>() + (inc ? 1 : -1);
+	WriteOperand8<index>(newData);
+
+	SetLazyFlags(inc ? FlagOp::Inc : FlagOp::Dec, 0, 0, newData, CarryFlagSet());
+
+	return index == IndirectHlIndex ? ThreeCycles : OneCycle;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ld8RegOrMemImm()
+{
+	const int index = (Opcode >> 3) & 0x7;
+	WriteOperand8<index>(GetByteOperand());
+
+	return index == IndirectHlIndex ? ThreeCycles : TwoCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Rlca()
+{
+	MaterialiseFlags();
+	return Rlca(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Rla()
+{
+	MaterialiseFlags();
+	return Rla(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Rrca()
+{
+	MaterialiseFlags();
+	return Rrca(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Rra()
+{
+	MaterialiseFlags();
+	return Rra(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::St16MemSp()
+{
+	return St16MemSp(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Add16RegReg()
+{
+	auto& regRef = Reg16Sp<(Opcode >> 4) & 0x3>();
+	auto res = _registers.HL + regRef;
+
+	SetFlags((ZeroFlagSet() ? ZeroFlag : NoFlags) | (res & 0x10000 ? CarryFlag : NoFlags) |
+			 ((_registers.HL & 0xfff) + (regRef & 0xfff) & 0x1000 ? HalfCarryFlag : NoFlags));
+	_registers.HL = static_cast<unsigned short>(res);
+
+	return TwoCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ld8AccMem()
+{
+	const int pair = (Opcode >> 4) & 0x3;
+	auto& ref = Reg16Sp<(pair < 2 ? pair : 2)>();
+	_registers.A = ReadByte(ref);
+
+	if (pair == 2) ref++;
+	else if (pair == 3) ref--;
+
+	return TwoCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Stop()
+{
+	return Stop(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Jr()
+{
+	auto offset = static_cast<char>(GetByteOperand());
+
+	if (Opcode == 0x18 || ConditionMet<(Opcode >> 3) & 0x3>())
+	{
+		_registers.PC += offset;
+		return ThreeCycles + (offset < 0 ? SkipIdleLoop(_registers.PC, ThreeCycles) : 0);
+	}
+
+	return TwoCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Daa()
+{
+	MaterialiseFlags();
+	return Daa(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Cpl()
+{
+	MaterialiseFlags();
+	return Cpl(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Scf()
+{
+	MaterialiseFlags();
+	return Scf(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ccf()
+{
+	MaterialiseFlags();
+	return Ccf(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ld8RegOrMemRegOrMem()
+{
+	const int destIndex = (Opcode >> 3) & 0x7;
+	const int srcIndex = Opcode & 0x7;
+
+	WriteOperand8<destIndex>(ReadOperand8<srcIndex>());
+
+	return destIndex == IndirectHlIndex || srcIndex == IndirectHlIndex ? TwoCycles : OneCycle;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Halt()
+{
+	return Halt(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::AluOp8AccRegOrMem()
+{
+	const int index = Opcode & 0x7;
+	Alu8<(Opcode >> 3) & 0x7>(ReadOperand8<index>());
+
+	return index == IndirectHlIndex ? TwoCycles : OneCycle;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Di()
+{
+	return Di(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ei()
+{
+	return Ei(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ret()
+{
+	const bool unconditional = (Opcode & 0x1) != 0;
+
+	if (unconditional || ConditionMet<(Opcode >> 3) & 0x3>())
+	{
+		_registers.PC = PopWord();
+
+		// RETI
+		if (Opcode == 0xd9) Ei(Opcode);
+
+		return unconditional ? FourCycles : FiveCycles;
+	}
+
+	return TwoCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Push16Reg()
+{
+	if (Opcode == 0xf5) MaterialiseFlags();
+	PushWord(Reg16Af<(Opcode >> 4) & 0x3>());
+	return FourCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Pop16Reg()
+{
+	Reg16Af<(Opcode >> 4) & 0x3>() = PopWord();
+
+	// Ensure lower nibble of F is zero after possible pop into it
+	if (Opcode == 0xf1) SetFlags(_registers.F & 0xf0);
+	else _registers.F &= 0xf0;
+
+	return ThreeCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Jp()
+{
+	auto address = GetWordOperand();
+
+	if (Opcode == 0xc3 || ConditionMet<(Opcode >> 3) & 0x3>())
+	{
+		auto backward = address < _registers.PC;
+		_registers.PC = address;
+
+		return FourCycles + (backward ? SkipIdleLoop(address, FourCycles) : 0);
+	}
+
+	return ThreeCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Call()
+{
+	auto address = GetWordOperand();
+
+	if (Opcode == 0xcd || ConditionMet<(Opcode >> 3) & 0x3>())
+	{
+		PushWord(_registers.PC);
+		_registers.PC = address;
+		return SixCycles;
+	}
+
+	return ThreeCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::AluOp8AccImm()
+{
+	Alu8<(Opcode >> 3) & 0x7>(GetByteOperand());
+	return TwoCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Rst()
+{
+	PushWord(_registers.PC);
+	_registers.PC = Opcode - 0xc7;
+
+	return FourCycles;
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::St8HiMemImmAcc()
+{
+	return St8HiMemImmAcc(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::St8HiMemCAcc()
+{
+	return St8HiMemCAcc(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ld8AccHiMemImm()
+{
+	return Ld8AccHiMemImm(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ld8AccHiMemC()
+{
+	return Ld8AccHiMemC(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Add8SpImm()
+{
+	MaterialiseFlags();
+	return Add8SpImm(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ld16HlSpImm()
+{
+	MaterialiseFlags();
+	return Ld16HlSpImm(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::JpHl()
+{
+	return JpHl(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ld8AccMemImm()
+{
+	return Ld8AccMemImm(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::St8MemImmAcc()
+{
+	return St8MemImmAcc(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Ld16SpHl()
+{
+	return Ld16SpHl(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::PrefixCb()
+{
+	auto nextOpcode = GetNextProgramByte();
+	return (this->*_specialisedCbOps[nextOpcode])();
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::InvalidOp()
+{
+	return InvalidOp(Opcode);
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::Execute()
+{
+	switch (Opcode)
+	{
+#define EXECUTE_CASE(op, handler) case op: return handler<op>();
+		CPU_OPCODE_TABLE(EXECUTE_CASE)
+#undef EXECUTE_CASE
+	}
+
+	return InvalidOp<Opcode>();
+}
+
+template<typename Bus>
+template<unsigned char Opcode>
+int CpuCore<Bus>::RunFused()
+{
+	return Execute<Opcode>();
+}
+
+template<typename Bus>
+template<unsigned char First, unsigned char Second, unsigned char... Rest>
+int CpuCore<Bus>::RunFused()
+{
+	auto cycles = Execute<First>();
+
+	// Stop where the dispatcher would have, including when the block has been invalidated by a write
+	if (_totalCycles + cycles >= _cycleBudgetEnd || _interruptCheckRequired || _state != CpuState::Running || _nextDecoded == _decodedEnd)
+	{
+		return cycles;
+	}
+
+	FetchDecodedOpcode();
+
+	// Handlers see the total cycle count as it would be if the instructions had been dispatched separately
+	_totalCycles += cycles;
+	auto restCycles = RunFused<Second, Rest...>();
+	_totalCycles -= cycles;
+
+	return cycles + restCycles;
+}
+
+template<typename Bus>
+template<unsigned char CbOpcode>
+int CpuCore<Bus>::CbOp()
+{
+	const int index = CbOpcode & 0x7;
+	const int bit = (CbOpcode >> 3) & 0x7;
+	const int cycleCount = index == IndirectHlIndex ? FourCycles : TwoCycles;
+
+	auto val = ReadOperand8<index>();
+	unsigned char carry;
+
+	switch (CbOpcode >> 6)
+	{
+	case 0:
+		// RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL
+		switch (bit)
+		{
+		case 0:
+			carry = val >> 7;
+			val = static_cast<unsigned char>(val << 1 | carry);
+			break;
+		case 1:
+			carry = val & 0x1;
+			val = static_cast<unsigned char>(val >> 1 | carry << 7);
+			break;
+		case 2:
+			carry = val >> 7;
+			val = static_cast<unsigned char>(val << 1 | (CarryFlagSet() ? 0x1 : 0));
+			break;
+		case 3:
+			carry = val & 0x1;
+			val = static_cast<unsigned char>(val >> 1 | (CarryFlagSet() ? 0x80 : 0));
+			break;
+		case 4:
+			carry = val >> 7;
+			val <<= 1;
+			break;
+		case 5:
+			carry = val & 0x1;
+			val = val >> 1 | (val & 0x80);
+			break;
+		case 6:
+			carry = 0;
+			val = static_cast<unsigned char>(val << 4 | val >> 4);
+			break;
+		default:
+			carry = val & 0x1;
+			val >>= 1;
+			break;
+		}
+
+		SetFlags((carry ? CarryFlag : NoFlags) | (val == 0 ? ZeroFlag : NoFlags));
+		break;
+
+	case 1:
+		// BIT doesn't write its operand back
+		SetLazyFlags(FlagOp::Bit, 0, 0, val & (0x1 << bit), CarryFlagSet());
+		return cycleCount;
+
+	case 2:
+		val &= ~(0x1 << bit);
+		break;
+
+	default:
+		val |= 0x1 << bit;
+		break;
+	}
+
+	WriteOperand8<index>(val);
+	return cycleCount;
+}
+
+template<typename Bus>
+template<std::size_t... CbOpcodes>
+std::array<int(CpuCore<Bus>::*)(), 256> CpuCore<Bus>::MakeSpecialisedCbOps(std::index_sequence<CbOpcodes...>)
+{
+	return {{ &CpuCore::CbOp<static_cast<unsigned char>(CbOpcodes)>... }};
+}
@@ -0,0 +1,227 @@
+#include "stdafx.h"
+#include "DecodedBlockCache.h"
+#include "MemoryMap.h"
+#include "CpuOpcodeTable.h"
+#include <algorithm>
+
+// Instruction lengths in bytes, including the opcode. STOP is treated as a single byte to match the interpreter
+const unsigned char DecodedBlockCache::_instructionLengths[256] =
+{
+	1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+	1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1
+};
+
+const std::vector<FusedSequence> DecodedBlockCache::_fusedSequences
+{
+#define FUSED_SEQUENCE(handler, ...) { handler, { __VA_ARGS__ } },
+	CPU_FUSED_TABLE(FUSED_SEQUENCE)
+#undef FUSED_SEQUENCE
+};
+
+DecodedBlockCache::DecodedBlockCache(MemoryMap& memoryMap) : _memoryMap(memoryMap), _hasRamBlocks(false)
+{
+	_lookupTable.fill(nullptr);
+	_ramCodeBytes.fill(0);
+}
+
+bool DecodedBlockCache::EndsBlock(unsigned char opcode)
+{
+	switch (opcode)
+	{
+	// STOP, HALT, EI
+	case 0x10: case 0x76: case 0xfb:
+	// JR
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+	// JP
+	case 0xc2: case 0xc3: case 0xca: case 0xd2: case 0xda: case 0xe9:
+	// CALL
+	case 0xc4: case 0xcc: case 0xcd: case 0xd4: case 0xdc:
+	// RET, RETI
+	case 0xc0: case 0xc8: case 0xc9: case 0xd0: case 0xd8: case 0xd9:
+	// RST
+	case 0xc7: case 0xcf: case 0xd7: case 0xdf: case 0xe7: case 0xef: case 0xf7: case 0xff:
+		return true;
+
+	default:
+		return IsInvalidOpcode(opcode);
+	}
+}
+
+bool DecodedBlockCache::IsInvalidOpcode(unsigned char opcode)
+{
+	switch (opcode)
+	{
+	case 0xd3: case 0xdb: case 0xdd: case 0xe3: case 0xe4: case 0xeb: case 0xec: case 0xed: case 0xf4: case 0xfc: case 0xfd:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+DecodedBlock& DecodedBlockCache::Decode(uint32_t key, int bank, unsigned short address)
+{
+	auto& block = _blocks[key];
+	block.Key = key;
+	block.Instructions.clear();
+	block.Executions = 0;
+	block.NativeCode = nullptr;
+	block.NativeGeneration = 0;
+
+	auto isRam = bank == MemoryMap::WorkRamCodeBank || bank == MemoryMap::HighRamCodeBank;
+
+	while (static_cast<int>(block.Instructions.size()) < MaxBlockInstructions)
+	{
+		DecodedInstruction instruction{ address, _memoryMap.PeekByte(address) };
+		instruction.Handler = instruction.Opcode;
+		auto length = _instructionLengths[instruction.Opcode];
+
+		// Don't let an instruction straddle memory that's mapped independently
+		auto withinBank = true;
+		for (auto i = 1; i < length; i++)
+		{
+			unsigned short operandAddress = address + i;
+			withinBank &= operandAddress > address && _memoryMap.GetCodeBank(operandAddress) == bank;
+		}
+
+		if (!withinBank) break;
+
+		for (auto i = 1; i < length; i++)
+		{
+			instruction.Operands[i - 1] = _memoryMap.PeekByte(address + i);
+		}
+
+		if (isRam)
+		{
+			for (auto i = 0; i < length; i++)
+			{
+				unsigned short codeAddress = address + i;
+				_ramCodeBytes[codeAddress >> 3] |= 1 << (codeAddress & 0x7);
+			}
+
+			_hasRamBlocks = true;
+		}
+
+		block.Instructions.push_back(instruction);
+
+		unsigned short nextAddress = address + length;
+		if (EndsBlock(instruction.Opcode) || nextAddress < address || _memoryMap.GetCodeBank(nextAddress) != bank) break;
+
+		address = nextAddress;
+	}
+
+	FuseSequences(block);
+
+	return block;
+}
+
+void DecodedBlockCache::FuseSequences(DecodedBlock& block)
+{
+	auto& instructions = block.Instructions;
+	auto count = instructions.size();
+	auto matchesOpcode = [](unsigned char opcode, const DecodedInstruction& instruction) { return opcode == instruction.Opcode; };
+
+	// Sequences can overlap (one's last opcode being another's first), so taking the first match from the
+	// start of the block can split a loop into fragments. Working back from the end instead, pick at each
+	// instruction the sequence (or none) that leaves the most instructions fused from there on, and with
+	// that the fewest handlers
+	struct Choice
+	{
+		int Fused;
+		int Handlers;
+		const FusedSequence* Sequence;
+	};
+
+	std::array<Choice, MaxBlockInstructions + 1> choices;
+	choices[count] = { 0, 0, nullptr };
+
+	for (auto i = count; i-- > 0;)
+	{
+		choices[i] = { choices[i + 1].Fused, choices[i + 1].Handlers, nullptr };
+
+		for (auto& sequence : _fusedSequences)
+		{
+			auto length = sequence.Opcodes.size();
+			if (i + length > count || !std::equal(sequence.Opcodes.begin(), sequence.Opcodes.end(), instructions.begin() + i, matchesOpcode))
+			{
+				continue;
+			}
+
+			auto fused = choices[i + length].Fused + static_cast<int>(length);
+			auto handlers = choices[i + length].Handlers + 1;
+			if (fused > choices[i].Fused || (fused == choices[i].Fused && handlers < choices[i].Handlers))
+			{
+				choices[i] = { fused, handlers, &sequence };
+			}
+		}
+	}
+
+	for (size_t i = 0; i < count;)
+	{
+		auto sequence = choices[i].Sequence;
+		if (sequence == nullptr)
+		{
+			i++;
+			continue;
+		}
+
+		instructions[i].Handler = sequence->Handler;
+		i += sequence->Opcodes.size();
+	}
+}
+
+DecodedBlock* DecodedBlockCache::GetBlock(unsigned short address)
+{
+	auto bank = _memoryMap.GetCodeBank(address);
+	if (bank == MemoryMap::UncachedCodeBank) return nullptr;
+
+	auto key = MakeKey(bank, address);
+	auto& entry = _lookupTable[LookupIndex(key)];
+
+	if (entry == nullptr || entry->Key != key)
+	{
+		auto existing = _blocks.find(key);
+		entry = existing != _blocks.end() ? &existing->second : &Decode(key, bank, address);
+	}
+
+	return entry->Instructions.empty() ? nullptr : entry;
+}
+
+void DecodedBlockCache::InvalidateRamBlocks()
+{
+	if (!_hasRamBlocks) return;
+
+	for (auto block = _blocks.begin(); block != _blocks.end();)
+	{
+		auto bank = static_cast<int>(block->first >> 16);
+
+		if (bank == MemoryMap::WorkRamCodeBank || bank == MemoryMap::HighRamCodeBank) block = _blocks.erase(block);
+		else ++block;
+	}
+
+	_lookupTable.fill(nullptr);
+	_ramCodeBytes.fill(0);
+	_hasRamBlocks = false;
+}
+
+void DecodedBlockCache::Clear()
+{
+	_blocks.clear();
+	_lookupTable.fill(nullptr);
+	_ramCodeBytes.fill(0);
+	_hasRamBlocks = false;
+}
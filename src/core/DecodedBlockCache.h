@@ -0,0 +1,94 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class MemoryMap;
+
+// A single pre-decoded instruction. Operands hold the bytes following the opcode
+// (including the second byte of CB-prefixed opcodes). Handler is the threaded engine's
+// dispatch id: the opcode, or a fused handler running this and the following instructions
+struct DecodedInstruction
+{
+	unsigned short Address;
+	unsigned char Opcode;
+	unsigned char Operands[2];
+	unsigned short Handler;
+};
+
+// Opcode sequence run by a fused handler, from CPU_FUSED_TABLE
+struct FusedSequence
+{
+	unsigned short Handler;
+	std::vector<unsigned char> Opcodes;
+};
+
+// Straight-line run of instructions ending at a control flow instruction
+struct DecodedBlock
+{
+	uint32_t Key;
+	std::vector<DecodedInstruction> Instructions;
+
+	// Used by the recompiler: times the block has been entered, and its native code along with the
+	// generation of the recompiler's code buffer it was compiled into
+	int Executions;
+	void* NativeCode;
+	unsigned int NativeGeneration;
+};
+
+// Caches decoded basic blocks keyed by (code bank, start address), so that code in ROM and RAM
+// is only fetched and decoded through the memory map once. ROM blocks are keyed by the bank mapped
+// when they're looked up, so bank switches naturally select the right set of blocks. RAM blocks are
+// tracked per byte and thrown away when any of their code is written to
+class DecodedBlockCache
+{
+	static const int MaxBlockInstructions = 32;
+	static const int LookupTableSize = 1024;
+
+	static const unsigned char _instructionLengths[256];
+	static const std::vector<FusedSequence> _fusedSequences;
+
+	MemoryMap& _memoryMap;
+
+	std::unordered_map<uint32_t, DecodedBlock> _blocks;
+
+	// Direct-mapped front end to _blocks, so that most lookups avoid hashing
+	std::array<DecodedBlock*, LookupTableSize> _lookupTable;
+
+	// One bit per address for RAM bytes that are part of a decoded block
+	std::array<unsigned char, 0x10000 / 8> _ramCodeBytes;
+	bool _hasRamBlocks;
+
+	static uint32_t MakeKey(int bank, unsigned short address) { return static_cast<uint32_t>(bank) << 16 | address; }
+	static unsigned int LookupIndex(uint32_t key) { return (key ^ key >> 13) & (LookupTableSize - 1); }
+
+	DecodedBlock& Decode(uint32_t key, int bank, unsigned short address);
+
+	// Points the first instruction of each fusable sequence in the block at its fused handler
+	static void FuseSequences(DecodedBlock& block);
+
+public:
+	explicit DecodedBlockCache(MemoryMap& memoryMap);
+
+	// Length of the instruction starting with opcode, in bytes
+	static int GetInstructionLength(unsigned char opcode) { return _instructionLengths[opcode]; }
+
+	// Returns true for opcodes that end a block: control flow, HALT/STOP/EI and invalid opcodes
+	static bool EndsBlock(unsigned char opcode);
+
+	// Returns true for the opcodes that lock up the CPU, which the interpreter reports with an exception
+	static bool IsInvalidOpcode(unsigned char opcode);
+
+	// Gets the decoded block starting at the given address in whatever is currently mapped there,
+	// decoding it first if needed. Returns null if code at the address can't be cached
+	DecodedBlock* GetBlock(unsigned short address);
+
+	bool IsRamCode(unsigned short address) const { return (_ramCodeBytes[address >> 3] & 1 << (address & 0x7)) != 0; }
+
+	// Discards all blocks decoded from RAM
+	void InvalidateRamBlocks();
+
+	// Discards all decoded blocks
+	void Clear();
+};
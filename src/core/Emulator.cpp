@@ -6,20 +6,21 @@ void Emulator::Run(int& currentCycle, int cycleTarget)
 {
 	while (currentCycle < cycleTarget)
 	{
-		auto cyclesToRun = std::min(cycleTarget - currentCycle, EmuTimer.GetCyclesToNextEvent());
-		auto cyclesRun = 0;
+		// A halted CPU can't observe the timer until an interrupt wakes it, so only timer interrupts bound its run
+		auto cyclesToTimerEvent = EmuCpu.IsClockRunning() ? EmuTimer.GetCyclesToNextEvent() : EmuTimer.GetCyclesToNextInterrupt();
+		auto startCycle = currentCycle;
 
-		while (cyclesRun < cyclesToRun) cyclesRun += EmuCpu.DoNextInstruction();
-
-		EmuTimer.RunCycles(cyclesRun);
-		currentCycle += cyclesRun;
+		EmuCpu.RunUntil(currentCycle, currentCycle + std::min(cycleTarget - currentCycle, cyclesToTimerEvent));
+		EmuTimer.RunCycles(currentCycle - startCycle);
 	}
 
 	currentCycle = std::max(currentCycle, cycleTarget);
 }
 
-Emulator::Emulator(std::shared_ptr<Cartridge> cartridge)
+Emulator::Emulator(std::shared_ptr<Cartridge> cartridge, CpuEngine cpuEngine, FrameFormat frameFormat)
+	: EmuGraphics{ EmuCpu, EmuMemoryMap, EmuSpriteManager, frameFormat }
 {
+	EmuCpu.SetEngine(cpuEngine);
 	EmuTimer.SetCpu(&EmuCpu);
 	EmuMemoryMap.SetTimer(&EmuTimer);
 	EmuMemoryMap.SetCartridge(cartridge);
@@ -28,36 +29,7 @@ Emulator::Emulator(std::shared_ptr<Cartridge> cartridge)
 
 int* Emulator::GetFrame()
 {
-	EmuGraphics.ResetFrame();
-	auto cycleCounter = 0;
-	auto cycleTarget = 0;
-
-	for (auto i = 0; i < Graphics::VertPixels; i++)
-	{
-		EmuGraphics.SetLcdcStatus(LcdcStatus::OamReadMode);
-		cycleTarget += Graphics::OamReadClocks;
-		Run(cycleCounter, cycleTarget);
-
-		EmuGraphics.SetLcdcStatus(LcdcStatus::OamAndVramReadMode);
-		cycleTarget += Graphics::OamAndVramReadClocks;
-		Run(cycleCounter, cycleTarget);
-
-		EmuGraphics.SetLcdcStatus(LcdcStatus::HBlankMode);
-		cycleTarget += Graphics::HBlankPeriodClocks;
-		Run(cycleCounter, cycleTarget);
-
-		EmuGraphics.RenderLine();
-	}
-
-	EmuGraphics.SetLcdcStatus(LcdcStatus::VBlankMode);
-
-	for (auto i = 0; i < Graphics::VBlankLines; i++)
-	{
-		cycleTarget += Graphics::ScanlineClocks;
-		Run(cycleCounter, cycleTarget);
-
-		EmuGraphics.RenderLine();
-	}
+	EmuGraphics.RunFrame([this](int& currentCycle, int cycleTarget) { Run(currentCycle, cycleTarget); });
 
 	return EmuGraphics.Bitmap;
 }
@@ -11,15 +11,19 @@ class Emulator
 	MemoryMap EmuMemoryMap { EmuJoypad };
 	Cpu EmuCpu{ EmuMemoryMap };
 	SpriteManager EmuSpriteManager;
-	Graphics EmuGraphics{ EmuCpu, EmuMemoryMap, EmuSpriteManager };
+	Graphics EmuGraphics;
 	Timer EmuTimer;
 
 	void Run(int& currentCycle, int cycleTarget);
 
 public:
-	explicit Emulator(std::shared_ptr<Cartridge> cartridge);
+	explicit Emulator(std::shared_ptr<Cartridge> cartridge, CpuEngine cpuEngine = CpuEngine::Threaded, FrameFormat frameFormat = FrameFormat::Rgba8888);
 
+	// Runs a frame and returns it, GetFrameSize() bytes in the chosen format
 	int* GetFrame();
+	unsigned int GetFrameSize() const { return EmuGraphics.GetFrameSize(); }
 	InputJoypad& GetJoypad() { return EmuJoypad; }
+
+	void SetOutputPalette(const Graphics::OutputPalette& palette) { EmuGraphics.SetOutputPalette(palette); }
 };
 
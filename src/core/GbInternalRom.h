@@ -5,8 +5,12 @@ class GbInternalRom
 	static const unsigned char _data[];
 
 public:
+	static const unsigned short Size = 0x100;
+
 	static unsigned char ReadByte(unsigned short address)
 	{
 		return _data[address];
 	}
+
+	static const unsigned char* Data() { return _data; }
 };
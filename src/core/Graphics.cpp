@@ -3,43 +3,160 @@
 #include "MemoryMap.h"
 #include "Cpu.h"
 #include "SpriteManager.h"
+#include <algorithm>
+#include <cstring>
 
-unsigned char Graphics::GetBgOrWinColour(int x, int y, TileType tileType) const
+#if defined(_M_X64) || defined(__x86_64__)
+#include <emmintrin.h>
+#define GRAPHICS_SSE2
+#endif
+
+namespace
+{
+	int TintedShade(int shade)
+	{
+		return static_cast<int>(0xc0000000 | (3 - shade) * 0x40504a);
+	}
+
+	int ToRgb565(int rgba)
+	{
+		return (rgba & 0xf8) << 8 | (rgba >> 8 & 0xfc) << 3 | (rgba >> 16 & 0xf8) >> 3;
+	}
+
+	template<typename Pixel> void WritePixels(Pixel* pixels, const unsigned char* line, const int* colours)
+	{
+		for (auto x = 0; x < Graphics::HozPixels; x++) pixels[x] = static_cast<Pixel>(colours[line[x]]);
+	}
+}
+
+void Graphics::FetchTileRow(unsigned char* line, int x, int y, TileType tileType, int tiles) const
 {
 	auto tileMapBase = _registers[RegLcdControl] & (tileType == TileType::Window ? 0x40 : 0x8)
 		                   ? TileMapBase2
 		                   : TileMapBase1;
 
-	auto tileNumber = _vram[tileMapBase + GetTileOffset(x, y)];
+	for (auto i = 0; i < tiles; i++)
+	{
+		auto tileNumber = _vram[tileMapBase + GetTileOffset(x + i * TileCache::TileWidth, y)];
+		memcpy(line + i * TileCache::TileWidth, _tileCache.GetRow(GetTileIndex(tileNumber), y & 0x7), TileCache::TileWidth);
+	}
+}
 
-	unsigned short tileDataBase;
+void Graphics::DrawSprites(unsigned char* spritesOverBlank, unsigned char* spritesOverColour, unsigned char* spritePalettes) const
+{
+	auto& visibleSprites = _spriteManager.GetVisibleSprites();
 
-	if (_registers[RegLcdControl] & 0x10)
+	// Paint sprites from lowest to highest priority. Over colour 0 the first opaque sprite pixel shows,
+	// otherwise the first sprite behind the background hides those after it
+	for (auto sprite = _spriteManager.GetVisibleSpriteCount() - 1; sprite >= 0; sprite--)
 	{
-		tileDataBase = TileDataTableBase1;
+		auto& spriteData = *visibleSprites[sprite];
+		auto left = spriteData.XPos - SpriteManager::SpriteXOffset;
+		auto palette = static_cast<unsigned char>(spriteData.Flags & SpriteFlags::PaletteSelector ? Palette::Sprite1 : Palette::Sprite0);
+		auto behindBackground = (spriteData.Flags & SpriteFlags::ZPriority) != 0;
+
+		for (auto x = std::max(left, 0); x < std::min<int>(left + SpriteManager::SpriteWidth, HozPixels); x++)
+		{
+			auto colour = _spriteManager.GetSpriteColour(spriteData, x, _currentScanline, _tileCache);
+
+			if (colour != 0) spritesOverBlank[x] = colour;
+			if (behindBackground) spritesOverColour[x] = 0;
+			else if (colour != 0) spritesOverColour[x] = colour;
+
+			// Matches the original per-pixel renderer, which took the palette from the first overlapping sprite
+			spritePalettes[x] = palette * ShadeCount;
+		}
 	}
-	else
+}
+
+Graphics::OutputPalette Graphics::GetDefaultOutputPalette(FrameFormat format)
+{
+	switch (format)
 	{
-		tileDataBase = TileDataTableBase2;
-		tileNumber += 128;
+	case FrameFormat::Rgb565:
+		return { ToRgb565(TintedShade(0)), ToRgb565(TintedShade(1)), ToRgb565(TintedShade(2)), ToRgb565(TintedShade(3)) };
+
+	case FrameFormat::Grey8:
+		return { 0xff, 0xaa, 0x55, 0x00 };
+
+	case FrameFormat::Indexed2:
+		return { 0, 1, 2, 3 };
+
+	default:
+		return { TintedShade(0), TintedShade(1), TintedShade(2), TintedShade(3) };
 	}
+}
 
-	auto baseByte = tileDataBase + (tileNumber * 16) + ((y & 0x7) << 1);
-	auto bitShift = 7 - x % 8;
+unsigned int Graphics::GetFrameSize(FrameFormat format)
+{
+	switch (format)
+	{
+	case FrameFormat::Rgb565: return HozPixels * VertPixels * 2;
+	case FrameFormat::Grey8: return HozPixels * VertPixels;
+	case FrameFormat::Indexed2: return HozPixels * VertPixels / 4;
+	default: return HozPixels * VertPixels * 4;
+	}
+}
+
+void Graphics::UpdatePalette(Palette palette)
+{
+	auto paletteData = _registers[RegBgWinPalette + static_cast<unsigned int>(palette)];
+	auto index = static_cast<unsigned int>(palette) * ShadeCount;
 
-	return _vram[baseByte] >> bitShift & 0x1 | (_vram[baseByte + 1] >> bitShift & 0x1) << 1;
+	for (auto colour = 0; colour < ShadeCount; colour++)
+	{
+		auto shade = paletteData >> (colour << 1) & 0x3;
+		_paletteShades[index + colour] = shade;
+		_paletteColours[index + colour] = _outputPalette[shade];
+	}
 }
 
-int Graphics::MapColour(unsigned char colour, Palette palette)
+void Graphics::OutputLine(const unsigned char* line)
 {
-	auto paletteData = _registers[palette == Palette::BgAndWindow
-		                              ? RegBgWinPalette
-		                              : palette == Palette::Sprite0
-										? RegSprite0Palette
-										: RegSprite1Palette];
-
-	// 75% opacity to emulate the slow GB screen response time. Green tinge to look more like the original
-	return 0xc0000000 | ((3 - (paletteData >> (colour << 1) & 0x3)) * 0x40504a);
+	auto pixelOffset = _currentScanline * HozPixels;
+
+	switch (_frameFormat)
+	{
+	case FrameFormat::Rgba8888:
+		WritePixels(Bitmap + pixelOffset, line, _paletteColours);
+		break;
+
+	case FrameFormat::Rgb565:
+		WritePixels(reinterpret_cast<uint16_t*>(Bitmap) + pixelOffset, line, _paletteColours);
+		break;
+
+	case FrameFormat::Grey8:
+		WritePixels(reinterpret_cast<unsigned char*>(Bitmap) + pixelOffset, line, _paletteColours);
+		break;
+
+	case FrameFormat::Indexed2:
+		{
+			auto pixels = reinterpret_cast<unsigned char*>(Bitmap) + pixelOffset / 4;
+
+			for (auto x = 0; x < HozPixels; x += 4)
+			{
+				pixels[x / 4] = _paletteShades[line[x]] << 6 | _paletteShades[line[x + 1]] << 4 | _paletteShades[line[x + 2]] << 2 | _paletteShades[line[x + 3]];
+			}
+		}
+		break;
+	}
+}
+
+void Graphics::OutputBlankLine()
+{
+	auto lineSize = GetFrameSize() / VertPixels;
+
+	// White for colour formats, shade 0 when indexed
+	memset(reinterpret_cast<unsigned char*>(Bitmap) + _currentScanline * lineSize, _frameFormat == FrameFormat::Indexed2 ? 0 : 0xff, lineSize);
+}
+
+void Graphics::SetOutputPalette(const OutputPalette& palette)
+{
+	_outputPalette = palette;
+
+	UpdatePalette(Palette::BgAndWindow);
+	UpdatePalette(Palette::Sprite0);
+	UpdatePalette(Palette::Sprite1);
 }
 
 void Graphics::CheckLineCompare()
@@ -53,14 +170,24 @@ void Graphics::CheckLineCompare()
 	}
 }
 
-Graphics::Graphics(Cpu& cpu, MemoryMap& memoryMap, SpriteManager& spriteManager)
-	: _cpu(cpu), _memoryMap(memoryMap), _screenEnabled(true), _totalCycles(0), _spriteManager(spriteManager)
+Graphics::Graphics(Cpu& cpu, MemoryMap& memoryMap, SpriteManager& spriteManager, FrameFormat frameFormat)
+	: _cpu(cpu), _memoryMap(memoryMap), _screenEnabled(true), _totalCycles(0), _frameFormat(frameFormat), _spriteManager(spriteManager)
 {
 	_memoryMap.SetGraphics(this);
+	_memoryMap.MapVram(_vram);
+
+	memset(_oam, 0, OamSize);
+	_spriteManager.SetSprites(reinterpret_cast<SpriteData*>(_oam));
+
+	_dirtyTiles.set();
+	_dirtyTileMapRows.set();
+	_dirtySprites.set();
 
 	_registers[RegBgWinPalette] = 0xff;
 	_registers[RegSprite0Palette] = 0xff;
 	_registers[RegSprite1Palette] = 0xff;
+
+	SetOutputPalette(GetDefaultOutputPalette(_frameFormat));
 }
 
 void Graphics::WriteOam(unsigned short address, unsigned char value)
@@ -69,6 +196,7 @@ void Graphics::WriteOam(unsigned short address, unsigned char value)
 	{
 		auto locationChanged = address % 4 < 2 && value != _oam[address];
 		_oam[address] = value;
+		_dirtySprites.set(address / 4);
 
 		if (locationChanged)
 		{
@@ -78,6 +206,13 @@ void Graphics::WriteOam(unsigned short address, unsigned char value)
 	}
 }
 
+void Graphics::LoadOam(const unsigned char* source)
+{
+	memcpy(_oam, source, OamSize);
+	_dirtySprites.set();
+	_spriteManager.ReloadSprites();
+}
+
 void Graphics::WriteRegister(unsigned short address, unsigned char value)
 {
 	// Writing to the line count register resets it
@@ -91,14 +226,7 @@ void Graphics::WriteRegister(unsigned short address, unsigned char value)
 	}
 	else if (address == RegDmaTransfer)
 	{
-		unsigned short sourceAddress = value << 8;
-		unsigned short destAddress = 0;
-
-		// Emulate DMA transfer
-		for (auto i = 0; i < OamSize; i++)
-		{
-			WriteOam(destAddress++, _memoryMap.ReadByte(sourceAddress++));
-		}
+		_memoryMap.StartOamDma(value);
 	}
 	else if (address == RegLcdStatus)
 	{
@@ -116,6 +244,11 @@ void Graphics::WriteRegister(unsigned short address, unsigned char value)
 	}
 
 	_registers[address] = value;
+
+	if (address >= RegBgWinPalette && address <= RegSprite1Palette)
+	{
+		UpdatePalette(static_cast<Palette>(address - RegBgWinPalette));
+	}
 }
 
 int Graphics::RenderLine()
@@ -132,75 +265,72 @@ int Graphics::RenderLine()
 	{
 		if (DisplayEnabled())
 		{
-			// A rather inefficient rendering implementation.
-			// Many intermediate results could be lifted outside loops
+			_tileCache.Update(_vram);
+
+			// The line is built up as colour indexes, background and window first, then sprites, which are
+			// blended in before the lot is looked up in the palette colours. Index bits 2-3 select the palette
+			const auto lineFetchSize = HozPixels + 2 * TileCache::TileWidth;
+			unsigned char background[lineFetchSize];
+			unsigned char window[lineFetchSize];
+
+			unsigned char spritesOverBlank[HozPixels] = {};
+			unsigned char spritesOverColour[HozPixels] = {};
+			unsigned char spritePalettes[HozPixels] = {};
+
+			alignas(16) unsigned char line[HozPixels];
 
-			auto backgroundY = _currentScanline + _registers[RegBgScrollY];
 			auto windowVisibleThisLine = WindowEnabled() && _currentScanline >= _registers[RegWindowY] && _registers[RegWindowX] < 167;
+			auto windowStart = windowVisibleThisLine ? std::max(_registers[RegWindowX] - 7, 0) : static_cast<int>(HozPixels);
+
+			if (BackgroundEnabled())
+			{
+				// Fetch a tile beyond the screen width for fine scrolling
+				auto scrollX = _registers[RegBgScrollX];
+				FetchTileRow(background, scrollX, _currentScanline + _registers[RegBgScrollY], TileType::Background, HozPixels / TileCache::TileWidth + 1);
+				memcpy(line, background + (scrollX & 0x7), windowStart);
+			}
+			else
+			{
+				memset(line, 0, windowStart);
+			}
+
+			if (windowStart < HozPixels)
+			{
+				// Window is over background
+				FetchTileRow(window, 0, _currentWindowScanline, TileType::Window, HozPixels / TileCache::TileWidth + 1);
+				memcpy(line + windowStart, window + windowStart - _registers[RegWindowX] + 7, HozPixels - windowStart);
+			}
 
-			auto visibleSprites = _spriteManager.GetVisibleSprites();
-			auto firstSpriteNotLeftOfX = visibleSprites.cbegin();
-			auto firstSpriteBelowY = visibleSprites.cend();
+			if (SpritesEnabled()) DrawSprites(spritesOverBlank, spritesOverColour, spritePalettes);
 
-			auto spritesThisLine = 0;
+			auto x = 0;
 
-			auto backgroundEnabled = BackgroundEnabled();
-			auto spritesEnabled = SpritesEnabled();
+#ifdef GRAPHICS_SSE2
+			auto zero = _mm_setzero_si128();
 
-			for (auto x = 0; x < HozPixels;x++)
+			for (; x + 16 <= HozPixels; x += 16)
 			{
-				unsigned char colour = 0;
-				auto windowX = x - _registers[RegWindowX] + 7;
-
-				if (windowVisibleThisLine && windowX >= 0)
-				{
-					// Window is over background
-					colour = GetBgOrWinColour(windowX, _currentWindowScanline, TileType::Window);
-				}
-				else if (backgroundEnabled)
-				{
-					auto backgroundX = x + _registers[RegBgScrollX];
-					colour = GetBgOrWinColour(backgroundX, backgroundY, TileType::Background);
-				}
-
-				auto spritePixelOnTop = false;
-				auto& pixel = Bitmap[_currentScanline*HozPixels + x];
-
-				if (spritesEnabled)
-				{
-					while (firstSpriteNotLeftOfX != firstSpriteBelowY && (*firstSpriteNotLeftOfX)->XPos - SpriteManager::SpriteXOffset + SpriteManager::SpriteWidth <= x)
-					{
-						++firstSpriteNotLeftOfX;
-						++spritesThisLine;
-					}
-
-					auto sprite = firstSpriteNotLeftOfX;
-
-					// Iterate through sprites overlapping this pixel as necessary until we either:
-					//  * Hit a non-transparent sprite pixel above the BG/Window
-					//  * Hit a sprite that is behind the BG/Window, at which point we use BG/Window pixel (regardless of lower-priority sprite settings)
-					//  * Run out of overlapping sprites
-					while ((sprite != firstSpriteBelowY && (*sprite)->XPos - SpriteManager::SpriteXOffset <= x && spritesThisLine <= SpriteManager::MaxSpritesPerLine &&
-						(!((*sprite)->Flags & SpriteFlags::ZPriority) || colour == 0)))
-					{
-						auto spriteColour = _spriteManager.GetSpriteColour(**sprite, x, _currentScanline, _vram);
-						spritePixelOnTop = spriteColour != 0;
-
-						if (spritePixelOnTop)
-						{
-							pixel = MapColour(spriteColour, (*firstSpriteNotLeftOfX)->Flags & SpriteFlags::PaletteSelector ? Palette::Sprite1 : Palette::Sprite0);
-							break;
-						}
-
-						++sprite;
-					}
-				}
-
-				if (!spritePixelOnTop)
-				{
-					pixel = MapColour(colour, Palette::BgAndWindow);
-				}
+				auto colours = _mm_load_si128(reinterpret_cast<const __m128i*>(line + x));
+				auto overBlank = _mm_loadu_si128(reinterpret_cast<const __m128i*>(spritesOverBlank + x));
+				auto overColour = _mm_loadu_si128(reinterpret_cast<const __m128i*>(spritesOverColour + x));
+				auto palettes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(spritePalettes + x));
+
+				auto blank = _mm_cmpeq_epi8(colours, zero);
+				auto sprites = _mm_or_si128(_mm_and_si128(blank, overBlank), _mm_andnot_si128(blank, overColour));
+				auto noSprite = _mm_cmpeq_epi8(sprites, zero);
+
+				colours = _mm_or_si128(_mm_and_si128(noSprite, colours), _mm_andnot_si128(noSprite, _mm_add_epi8(sprites, palettes)));
+				_mm_store_si128(reinterpret_cast<__m128i*>(line + x), colours);
 			}
+#endif
+
+			for (; x < HozPixels; x++)
+			{
+				auto sprite = line[x] == 0 ? spritesOverBlank[x] : spritesOverColour[x];
+				if (sprite != 0) line[x] = sprite + spritePalettes[x];
+			}
+
+			OutputLine(line);
 
 			if (windowVisibleThisLine)
 			{
@@ -209,7 +339,7 @@ int Graphics::RenderLine()
 		}
 		else
 		{
-			memset(&Bitmap[_currentScanline*HozPixels], 0xff, HozPixels*4);
+			OutputBlankLine();
 		}
 	}
 
@@ -224,7 +354,12 @@ int Graphics::RenderLine()
 
 void Graphics::SetLcdcStatus(LcdcStatus status)
 {
+	auto vramWasAccessible = _status != LcdcStatus::OamAndVramReadMode;
 	_status = DisplayEnabled() ? status : LcdcStatus::HBlankMode;
+
+	// VRAM is locked out from the CPU while it's being read to draw the line
+	auto vramAccessible = _status != LcdcStatus::OamAndVramReadMode;
+	if (vramAccessible != vramWasAccessible) _memoryMap.MapVram(vramAccessible ? _vram : nullptr);
 	_registers[RegLcdStatus] = (_registers[RegLcdStatus] & 0xfc) | status;
 
 	if (!DisplayEnabled()) return;
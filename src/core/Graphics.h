@@ -1,8 +1,11 @@
 #pragma once
+#include <array>
+#include <bitset>
 #include <cstdint>
+#include "CpuFwd.h"
+#include "TileCache.h"
 
 class MemoryMap;
-class Cpu;
 class SpriteManager;
 
 enum LcdcStatus : unsigned char
@@ -13,6 +16,15 @@ enum LcdcStatus : unsigned char
 	OamAndVramReadMode	= 3
 };
 
+// Pixel layouts frames can be drawn in. Rows are HozPixels wide, with no padding between them
+enum class FrameFormat
+{
+	Rgba8888,	// 32-bit colour, bytes in RGBA order
+	Rgb565,		// 16-bit colour, red in the top bits
+	Grey8,		// One byte per pixel
+	Indexed2	// Shades 0-3, lightest first, four pixels per byte with the leftmost in the top bits
+};
+
 enum SpriteFlags : unsigned char
 {
 	PaletteSelector = 0x10,
@@ -29,11 +41,6 @@ struct SpriteData
 	unsigned char XPos;
 	unsigned char PatternNum;
 	SpriteFlags Flags;
-
-	uintptr_t SpriteData::OrderedSpriteId() const
-	{
-		return reinterpret_cast<uintptr_t>(this);
-	}
 };
 // Windows-specific
 #pragma pack(pop)
@@ -61,10 +68,28 @@ public:
 	static const unsigned int VramSize = 1 << 13;
 	static const unsigned int OamSize = 160;
 
+	static const unsigned int TileSize = TileCache::TileSize;
+	static const unsigned int TileCount = TileCache::TileCount;
+	static const unsigned int TileMapRows = 32;
+	static const unsigned int TileMapColumns = 32;
+	static const unsigned int SpriteCount = OamSize / 4;
+
 	static const unsigned short SpriteDataTableBase = 0;
 
+	static const unsigned int ShadeCount = 4;
+
+	// Output colours of the four shades, lightest first, as pixel values in the frame format.
+	// Not used for indexed frames, which hold the shades themselves
+	using OutputPalette = std::array<int, ShadeCount>;
+
+	// Green-tinged shades at 75% opacity for colour formats, looking like the original screen and its
+	// slow response time. Evenly spaced levels for greyscale
+	static OutputPalette GetDefaultOutputPalette(FrameFormat format);
+
+	static unsigned int GetFrameSize(FrameFormat format);
+
 protected:
-	static const unsigned int RegisterBlockSize = 0xb;
+	static const unsigned int RegisterBlockSize = 0xc;
 
 	static const unsigned short TileDataTableBase1 = 0;
 	static const unsigned short TileDataTableBase2 = 0x800;
@@ -96,7 +121,15 @@ protected:
 	unsigned char _vram[VramSize];
 	unsigned char _oam[OamSize];
 
-	unsigned char _registers[RegisterBlockSize];
+	unsigned char _registers[RegisterBlockSize]{};
+
+	// Tiles, rows of the two tile maps (the second map's rows following the first's) and sprites written
+	// since their bitmap was last cleared. Everything starts out dirty
+	std::bitset<TileCount> _dirtyTiles;
+	std::bitset<TileMapRows * 2> _dirtyTileMapRows;
+	std::bitset<SpriteCount> _dirtySprites;
+
+	TileCache _tileCache;
 
 	unsigned int _currentScanline;
 	unsigned int _currentWindowScanline;
@@ -109,15 +142,42 @@ protected:
 	static int GetTileOffset(int x, int y) { return ((y & 0xf8) << 2) + ((x & 0xff) >> 3); }
 
 	enum class TileType { Background, Window };
+	// In the same order as their registers
 	enum class Palette { BgAndWindow, Sprite0, Sprite1 };
+	static const unsigned int PaletteCount = 3;
+
+	// Tile cache index of a tile number from a tile map, as per the selected tile data table
+	int GetTileIndex(unsigned char tileNumber) const
+	{
+		// The second tile data table holds tiles -128 to 127, starting half way into the first
+		return _registers[RegLcdControl] & 0x10
+			       ? tileNumber
+			       : TileDataTableBase2 / TileSize + static_cast<unsigned char>(tileNumber + 128);
+	}
 
-	unsigned char GetBgOrWinColour(int x, int y, TileType tileType) const;
+	// Copies colour indexes for a run of tiles along line y of a tile map, starting with the tile holding x
+	void FetchTileRow(unsigned char* line, int x, int y, TileType tileType, int tiles) const;
 
-	int MapColour(unsigned char colour, Palette palette);
+	// Fills in colour indexes of sprite pixels along the current line, for pixels with background colour 0
+	// and otherwise, along with the palette of each pixel's first overlapping sprite
+	void DrawSprites(unsigned char* spritesOverBlank, unsigned char* spritesOverColour, unsigned char* spritePalettes) const;
+
+	const FrameFormat _frameFormat;
+	OutputPalette _outputPalette;
+
+	// Shade and output colour of each palette's colour indexes, four per palette, rebuilt when a palette changes
+	unsigned char _paletteShades[PaletteCount * ShadeCount];
+	int _paletteColours[PaletteCount * ShadeCount];
+
+	void UpdatePalette(Palette palette);
+
+	// Writes a line of palette and colour indexes to the frame in its format
+	void OutputLine(const unsigned char* line);
+	void OutputBlankLine();
 
 	// Used as a dummy read/write location when an attempt is made to access
 	// VRAM or OAM during periods when it is inaccessible on the real hardware
-	unsigned char _dummy;
+	unsigned char _dummy{ 0xff };
 
 	SpriteManager& _spriteManager;
 
@@ -125,17 +185,52 @@ protected:
 
 public:
 
+	// The frame, in the format chosen on construction. Sized for the largest format
 	int Bitmap[HozPixels * VertPixels];
 
-	Graphics(Cpu& cpu, MemoryMap& memoryMap, SpriteManager& spriteManager);
+	Graphics(Cpu& cpu, MemoryMap& memoryMap, SpriteManager& spriteManager, FrameFormat frameFormat = FrameFormat::Rgba8888);
+
+	FrameFormat GetFrameFormat() const { return _frameFormat; }
+	unsigned int GetFrameSize() const { return GetFrameSize(_frameFormat); }
 
-	unsigned char& Vram(unsigned short address) { return _status != LcdcStatus::OamAndVramReadMode ? _vram[address] : _dummy; }
+	unsigned char Vram(unsigned short address) const { return _status != LcdcStatus::OamAndVramReadMode ? _vram[address] : _dummy; }
+
+	// All CPU writes to VRAM come through here, as the memory map only maps it for reading
+	void WriteVram(unsigned short address, unsigned char value)
+	{
+		if (_status == LcdcStatus::OamAndVramReadMode) return;
+
+		_vram[address] = value;
+
+		if (address < TileMapBase1)
+		{
+			_dirtyTiles.set(address / TileSize);
+			_tileCache.Invalidate(address / TileSize);
+		}
+		else _dirtyTileMapRows.set((address - TileMapBase1) / TileMapColumns);
+	}
+
+	const std::bitset<TileCount>& GetDirtyTiles() const { return _dirtyTiles; }
+	const std::bitset<TileMapRows * 2>& GetDirtyTileMapRows() const { return _dirtyTileMapRows; }
+	const std::bitset<SpriteCount>& GetDirtySprites() const { return _dirtySprites; }
+
+	void ClearDirtyTiles() { _dirtyTiles.reset(); }
+	void ClearDirtyTileMapRows() { _dirtyTileMapRows.reset(); }
+	void ClearDirtySprites() { _dirtySprites.reset(); }
+
+	const TileCache& GetTileCache() const { return _tileCache; }
+
+	const OutputPalette& GetOutputPalette() const { return _outputPalette; }
+	void SetOutputPalette(const OutputPalette& palette);
 
 	unsigned char ReadOam(unsigned short address) { return _status != LcdcStatus::OamReadMode && _status != LcdcStatus::OamAndVramReadMode
 															? _oam[address] : 0xff; }
 
 	void WriteOam(unsigned short address, unsigned char value);
 
+	// Replaces all of OAM, as done by OAM DMA, which has access whatever the mode
+	void LoadOam(const unsigned char* source);
+
 	unsigned char ReadRegister(unsigned short address) const { return _registers[address] | (address == RegLcdStatus ? 0x80 : 0); }
 
 	void WriteRegister(unsigned short address, unsigned char value);
@@ -149,4 +244,40 @@ public:
 	int RenderLine();
 
 	void SetLcdcStatus(LcdcStatus status);
+
+	// Runs a frame, stepping through the modes of each scanline and rendering it. run(currentCycle, cycleTarget)
+	// emulates the CPU, and whatever is clocked alongside it, up to each mode change
+	template<typename RunUntil> void RunFrame(RunUntil run)
+	{
+		ResetFrame();
+		auto cycleCounter = 0;
+		auto cycleTarget = 0;
+
+		for (auto i = 0; i < VertPixels; i++)
+		{
+			SetLcdcStatus(LcdcStatus::OamReadMode);
+			cycleTarget += OamReadClocks;
+			run(cycleCounter, cycleTarget);
+
+			SetLcdcStatus(LcdcStatus::OamAndVramReadMode);
+			cycleTarget += OamAndVramReadClocks;
+			run(cycleCounter, cycleTarget);
+
+			SetLcdcStatus(LcdcStatus::HBlankMode);
+			cycleTarget += HBlankPeriodClocks;
+			run(cycleCounter, cycleTarget);
+
+			RenderLine();
+		}
+
+		SetLcdcStatus(LcdcStatus::VBlankMode);
+
+		for (auto i = 0; i < VBlankLines; i++)
+		{
+			cycleTarget += ScanlineClocks;
+			run(cycleCounter, cycleTarget);
+
+			RenderLine();
+		}
+	}
 };
\ No newline at end of file
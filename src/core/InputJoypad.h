@@ -1,4 +1,5 @@
 #pragma once
+#include "CpuFwd.h"
 
 enum JoypadKey
 {
@@ -14,7 +15,6 @@ enum JoypadKey
 	Start	= 1 << 7
 };
 
-class Cpu;
 
 class InputJoypad
 {
@@ -0,0 +1,146 @@
+#include "stdafx.h"
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	UnmapViewOfFile(_data);
+	CloseHandle(_mapping);
+	if (_handle != nullptr) CloseHandle(_handle);
+#else
+	munmap(_data, _size);
+	if (_descriptor >= 0) close(_descriptor);
+#endif
+}
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string& filePath)
+{
+#ifdef _WIN32
+	auto handle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) return nullptr;
+
+	LARGE_INTEGER size;
+	auto mapping = GetFileSizeEx(handle, &size) && size.QuadPart > 0
+		? CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr)
+		: nullptr;
+
+	// The mapping keeps the file open
+	CloseHandle(handle);
+	if (mapping == nullptr) return nullptr;
+
+	auto data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (data == nullptr)
+	{
+		CloseHandle(mapping);
+		return nullptr;
+	}
+
+	std::unique_ptr<MappedFile> file{ new MappedFile };
+	file->_mapping = mapping;
+	file->_size = static_cast<size_t>(size.QuadPart);
+#else
+	auto descriptor = open(filePath.c_str(), O_RDONLY);
+	if (descriptor < 0) return nullptr;
+
+	struct stat status;
+	auto data = fstat(descriptor, &status) == 0 && status.st_size > 0
+		? mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, descriptor, 0)
+		: MAP_FAILED;
+
+	// The mapping keeps the file open
+	close(descriptor);
+	if (data == MAP_FAILED) return nullptr;
+
+	std::unique_ptr<MappedFile> file{ new MappedFile };
+	file->_size = static_cast<size_t>(status.st_size);
+#endif
+
+	file->_data = static_cast<unsigned char*>(data);
+	return file;
+}
+
+std::unique_ptr<MappedFile> MappedFile::OpenWritable(const std::string& filePath, size_t size)
+{
+	if (size == 0) return nullptr;
+
+#ifdef _WIN32
+	// Not sharing write access keeps any other writer out while the handle's open
+	auto handle = CreateFileA(filePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) return nullptr;
+
+	// Mapping more than the file holds extends it
+	LARGE_INTEGER existingSize;
+	auto mappingSize = GetFileSizeEx(handle, &existingSize) && static_cast<unsigned long long>(existingSize.QuadPart) > size
+		? static_cast<unsigned long long>(existingSize.QuadPart)
+		: static_cast<unsigned long long>(size);
+
+	auto mapping = CreateFileMappingA(handle, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(mappingSize >> 32), static_cast<DWORD>(mappingSize), nullptr);
+
+	auto data = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size) : nullptr;
+
+	if (data == nullptr)
+	{
+		if (mapping != nullptr) CloseHandle(mapping);
+		CloseHandle(handle);
+		return nullptr;
+	}
+
+	std::unique_ptr<MappedFile> file{ new MappedFile };
+	file->_mapping = mapping;
+	file->_handle = handle;
+#else
+	auto descriptor = open(filePath.c_str(), O_RDWR | O_CREAT, 0644);
+	if (descriptor < 0) return nullptr;
+
+	// flock locks belong to the open file, so they also keep out other MappedFiles in this process
+	if (flock(descriptor, LOCK_EX | LOCK_NB) != 0)
+	{
+		close(descriptor);
+		return nullptr;
+	}
+
+	// Extra data some emulators append, such as clock state, is kept but not mapped
+	struct stat status;
+	auto data = fstat(descriptor, &status) == 0 && (static_cast<size_t>(status.st_size) >= size || ftruncate(descriptor, size) == 0)
+		? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0)
+		: MAP_FAILED;
+
+	if (data == MAP_FAILED)
+	{
+		close(descriptor);
+		return nullptr;
+	}
+
+	std::unique_ptr<MappedFile> file{ new MappedFile };
+	file->_descriptor = descriptor;
+#endif
+
+	file->_data = static_cast<unsigned char*>(data);
+	file->_size = size;
+	file->_writable = true;
+	return file;
+}
+
+void MappedFile::Flush(size_t offset, size_t size) const
+{
+#ifdef _WIN32
+	FlushViewOfFile(_data + offset, size);
+#else
+	// msync needs a page-aligned start
+	auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	auto start = offset / pageSize * pageSize;
+	msync(_data + start, offset + size - start, MS_SYNC);
+#endif
+}
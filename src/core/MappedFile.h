@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Memory mapping of a whole file, read-only unless opened for writing. Its pages are loaded on first
+// access and shared by every process mapping the same file
+class MappedFile
+{
+	unsigned char* _data;
+	size_t _size;
+	bool _writable;
+
+	// Writable files are kept open, holding an exclusive lock on them, until unmapped
+#ifdef _WIN32
+	void* _mapping;
+	void* _handle;
+#else
+	int _descriptor;
+#endif
+
+	// Only constructed by Open, once mapping has succeeded
+#ifdef _WIN32
+	MappedFile() : _data(nullptr), _size(0), _writable(false), _mapping(nullptr), _handle(nullptr) {}
+#else
+	MappedFile() : _data(nullptr), _size(0), _writable(false), _descriptor(-1) {}
+#endif
+
+public:
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Maps the file at filePath. Returns null if it can't be opened or mapped, or is empty
+	static std::unique_ptr<MappedFile> Open(const std::string& filePath);
+
+	// Maps size bytes of the file at filePath for reading and writing, creating the file or extending it
+	// with zeros as needed. Only one MappedFile, in any process, can have a file open for writing at a
+	// time. Returns null if it can't be opened or mapped, or is already open for writing
+	static std::unique_ptr<MappedFile> OpenWritable(const std::string& filePath, size_t size);
+
+	const unsigned char* Data() const { return _data; }
+	size_t Size() const { return _size; }
+
+	// Null unless opened with OpenWritable
+	unsigned char* WritableData() const { return _writable ? _data : nullptr; }
+
+	// Writes changes made to the given range back to the file, waiting for them to complete
+	void Flush(size_t offset, size_t size) const;
+};
@@ -0,0 +1,38 @@
+#include "stdafx.h"
+#include "Mbc1Cartridge.h"
+
+Mbc1Cartridge::Mbc1Cartridge(std::shared_ptr<const RomImage> rom, int ramBanks) : Cartridge(std::move(rom), ramBanks)
+{
+	_ramEnabled = false;
+	UpdateBanks();
+}
+
+void Mbc1Cartridge::RomWriteByte(unsigned short address, unsigned char value)
+{
+	switch (address >> 13)
+	{
+	case 0:
+		_ramEnabled = (value & 0xf) == 0xa;
+		break;
+
+	case 1:
+		// Bank 0 can't be selected here, so 0x00, 0x20, 0x40 and 0x60 map the bank following them
+		_lowerBankBits = value & 0x1f;
+		if (_lowerBankBits == 0) _lowerBankBits = 1;
+		break;
+
+	case 2:
+		_upperBankBits = value & 0x3;
+		break;
+
+	case 3:
+		_advancedBanking = (value & 0x1) != 0;
+		break;
+	}
+
+	_selectedRomBank = _upperBankBits << 5 | _lowerBankBits;
+	_lowerRomBank = _advancedBanking ? _upperBankBits << 5 : 0;
+	_selectedRamBank = _advancedBanking ? _upperBankBits : 0;
+
+	UpdateBanks();
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "Cartridge.h"
+
+// MBC1: up to 2MB of ROM and 32KB of RAM. The two bits of the upper bank register select either
+// bits 5-6 of the ROM bank, or in mode 1 also the RAM bank and the bank mapped at 0x0000-0x3fff
+class Mbc1Cartridge : public Cartridge
+{
+	int _lowerBankBits{ 1 };
+	int _upperBankBits{ 0 };
+	bool _advancedBanking{ false };
+
+public:
+	Mbc1Cartridge(std::shared_ptr<const RomImage> rom, int ramBanks);
+
+	void RomWriteByte(unsigned short address, unsigned char value) override;
+};
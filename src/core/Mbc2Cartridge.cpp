@@ -0,0 +1,40 @@
+#include "stdafx.h"
+#include "Mbc2Cartridge.h"
+
+Mbc2Cartridge::Mbc2Cartridge(std::shared_ptr<const RomImage> rom) : Cartridge(std::move(rom), 0)
+{
+	// Less than a bank, so UpdateBanks never maps it
+	_ram.reset(new CartridgeRam(NibbleRamSize));
+	_ramEnabled = false;
+}
+
+unsigned char Mbc2Cartridge::RamReadByte(unsigned short address) const
+{
+	// Upper nibble reads as open bus
+	return _ramEnabled ? 0xf0 | _ram->Data()[address & (NibbleRamSize - 1)] : 0xff;
+}
+
+void Mbc2Cartridge::RomWriteByte(unsigned short address, unsigned char value)
+{
+	// Only the lower half of ROM holds registers, with address bit 8 selecting which one
+	if (address >= RomImage::BankSize) return;
+
+	if ((address & 0x100) == 0)
+	{
+		_ramEnabled = (value & 0xf) == 0xa;
+		return;
+	}
+
+	_selectedRomBank = value & 0xf;
+	if (_selectedRomBank == 0) _selectedRomBank = 1;
+
+	UpdateBanks();
+}
+
+void Mbc2Cartridge::RamWriteByte(unsigned short address, unsigned char value)
+{
+	if (!_ramEnabled) return;
+
+	_ram->Data()[address & (NibbleRamSize - 1)] = value & 0xf;
+	_ram->MarkDirty(address & (NibbleRamSize - 1));
+}
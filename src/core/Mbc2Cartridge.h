@@ -0,0 +1,17 @@
+#pragma once
+#include "Cartridge.h"
+
+// MBC2: up to 256KB of ROM, and 512 4-bit cells of built-in RAM repeated across 0xa000-0xbfff.
+// As only the lower nibble of each byte exists, the RAM is never mapped directly
+class Mbc2Cartridge : public Cartridge
+{
+	static const size_t NibbleRamSize = 512;
+
+public:
+	explicit Mbc2Cartridge(std::shared_ptr<const RomImage> rom);
+
+	unsigned char RamReadByte(unsigned short address) const override;
+
+	void RomWriteByte(unsigned short address, unsigned char value) override;
+	void RamWriteByte(unsigned short address, unsigned char value) override;
+};
@@ -0,0 +1,131 @@
+#include "stdafx.h"
+#include "Mbc3Cartridge.h"
+
+Mbc3Cartridge::Mbc3Cartridge(std::shared_ptr<const RomImage> rom, int ramBanks) : Cartridge(std::move(rom), ramBanks),
+			_rtcReference(std::time(nullptr))
+{
+	_latchedRtc.fill(0);
+	_ramEnabled = false;
+	UpdateBanks();
+}
+
+void Mbc3Cartridge::UpdateBanks()
+{
+	Cartridge::UpdateBanks();
+
+	if (_selectedRtcRegister != 0) _selectedRam = nullptr;
+}
+
+int64_t Mbc3Cartridge::GetRtcCounter()
+{
+	if (_rtcHalted) return _rtcCounter;
+
+	auto now = std::time(nullptr);
+	auto counter = _rtcCounter + static_cast<int64_t>(std::difftime(now, _rtcReference));
+
+	// The day counter sets the carry bit as it overflows, which stays set until cleared by the game
+	if (counter >= static_cast<int64_t>(DayCounterDays) * SecondsPerDay)
+	{
+		_rtcDayCarry = true;
+		counter %= static_cast<int64_t>(DayCounterDays) * SecondsPerDay;
+	}
+
+	_rtcCounter = counter;
+	_rtcReference = now;
+
+	return counter;
+}
+
+void Mbc3Cartridge::SetRtcCounter(int64_t counter)
+{
+	_rtcCounter = counter;
+	_rtcReference = std::time(nullptr);
+}
+
+void Mbc3Cartridge::LatchRtc()
+{
+	auto counter = GetRtcCounter();
+	auto days = static_cast<int>(counter / SecondsPerDay);
+
+	_latchedRtc[RtcSeconds - RtcSeconds] = static_cast<unsigned char>(counter % 60);
+	_latchedRtc[RtcMinutes - RtcSeconds] = static_cast<unsigned char>(counter / 60 % 60);
+	_latchedRtc[RtcHours - RtcSeconds] = static_cast<unsigned char>(counter / 3600 % 24);
+	_latchedRtc[RtcDayLow - RtcSeconds] = static_cast<unsigned char>(days);
+	_latchedRtc[RtcDayHigh - RtcSeconds] = static_cast<unsigned char>((days >> 8 & DayHighBit) |
+		(_rtcHalted ? HaltBit : 0) | (_rtcDayCarry ? DayCarryBit : 0));
+}
+
+void Mbc3Cartridge::WriteRtc(unsigned char value)
+{
+	auto counter = GetRtcCounter();
+	auto days = counter / SecondsPerDay;
+	auto seconds = counter % 60;
+	auto minutes = counter / 60 % 60;
+	auto hours = counter / 3600 % 24;
+
+	switch (_selectedRtcRegister)
+	{
+	case RtcSeconds: seconds = value % 60; break;
+	case RtcMinutes: minutes = value % 60; break;
+	case RtcHours: hours = value % 24; break;
+	case RtcDayLow: days = (days & 0x100) | value; break;
+
+	case RtcDayHigh:
+		days = (value & DayHighBit) << 8 | (days & 0xff);
+		_rtcHalted = (value & HaltBit) != 0;
+		_rtcDayCarry = (value & DayCarryBit) != 0;
+		break;
+	}
+
+	SetRtcCounter(((days * 24 + hours) * 60 + minutes) * 60 + seconds);
+
+	// Keep the register readable as written
+	_latchedRtc[_selectedRtcRegister - RtcSeconds] = value;
+}
+
+unsigned char Mbc3Cartridge::RamReadByte(unsigned short address) const
+{
+	if (_selectedRtcRegister == 0) return Cartridge::RamReadByte(address);
+
+	return _ramEnabled ? _latchedRtc[_selectedRtcRegister - RtcSeconds] : 0xff;
+}
+
+void Mbc3Cartridge::RomWriteByte(unsigned short address, unsigned char value)
+{
+	switch (address >> 13)
+	{
+	case 0:
+		_ramEnabled = (value & 0xf) == 0xa;
+		break;
+
+	case 1:
+		_selectedRomBank = value & 0x7f;
+		if (_selectedRomBank == 0) _selectedRomBank = 1;
+		break;
+
+	case 2:
+		if (value >= RtcSeconds && value <= RtcDayHigh)
+		{
+			_selectedRtcRegister = value;
+		}
+		else
+		{
+			_selectedRtcRegister = 0;
+			_selectedRamBank = value & 0x3;
+		}
+		break;
+
+	case 3:
+		if (_lastLatchWrite == 0 && value == 1) LatchRtc();
+		_lastLatchWrite = value;
+		return;
+	}
+
+	UpdateBanks();
+}
+
+void Mbc3Cartridge::RamWriteByte(unsigned short address, unsigned char value)
+{
+	if (_selectedRtcRegister == 0) Cartridge::RamWriteByte(address, value);
+	else if (_ramEnabled) WriteRtc(value);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include "Cartridge.h"
+
+// MBC3: up to 2MB of ROM, 32KB of RAM and optionally a real time clock. The clock's registers are
+// selected in place of a RAM bank and read from a copy latched by writing 0 then 1 to 0x6000-0x7fff
+class Mbc3Cartridge : public Cartridge
+{
+public:
+	enum RtcRegister
+	{
+		RtcSeconds = 0x08,
+		RtcMinutes,
+		RtcHours,
+		RtcDayLow,
+		RtcDayHigh
+	};
+
+private:
+	static const int SecondsPerDay = 24 * 60 * 60;
+	static const int DayCounterDays = 512;
+
+	static const unsigned char DayHighBit = 0x01;
+	static const unsigned char HaltBit = 0x40;
+	static const unsigned char DayCarryBit = 0x80;
+
+	// Selected clock register, or 0 while a RAM bank is selected
+	int _selectedRtcRegister{ 0 };
+	unsigned char _lastLatchWrite{ 0xff };
+
+	// The clock keeps running with the host's, as the counter's value at _rtcReference plus the time since
+	int64_t _rtcCounter{ 0 };
+	std::time_t _rtcReference;
+	bool _rtcHalted{ false };
+	bool _rtcDayCarry{ false };
+
+	std::array<unsigned char, 5> _latchedRtc;
+
+	int64_t GetRtcCounter();
+	void SetRtcCounter(int64_t counter);
+
+	void LatchRtc();
+	void WriteRtc(unsigned char value);
+
+protected:
+	void UpdateBanks() override;
+
+public:
+	Mbc3Cartridge(std::shared_ptr<const RomImage> rom, int ramBanks);
+
+	unsigned char RamReadByte(unsigned short address) const override;
+
+	void RomWriteByte(unsigned short address, unsigned char value) override;
+	void RamWriteByte(unsigned short address, unsigned char value) override;
+};
@@ -0,0 +1,35 @@
+#include "stdafx.h"
+#include "Mbc5Cartridge.h"
+
+Mbc5Cartridge::Mbc5Cartridge(std::shared_ptr<const RomImage> rom, int ramBanks) : Cartridge(std::move(rom), ramBanks)
+{
+	_ramEnabled = false;
+	UpdateBanks();
+}
+
+void Mbc5Cartridge::RomWriteByte(unsigned short address, unsigned char value)
+{
+	switch (address >> 12)
+	{
+	case 0: case 1:
+		_ramEnabled = (value & 0xf) == 0xa;
+		break;
+
+	case 2:
+		_selectedRomBank = (_selectedRomBank & 0x100) | value;
+		break;
+
+	case 3:
+		_selectedRomBank = (value & 0x1) << 8 | (_selectedRomBank & 0xff);
+		break;
+
+	case 4: case 5:
+		_selectedRamBank = value & 0xf;
+		break;
+
+	default:
+		return;
+	}
+
+	UpdateBanks();
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "Cartridge.h"
+
+// MBC5: up to 8MB of ROM with a 9-bit bank number and 128KB of RAM. Unlike the earlier
+// controllers, bank 0 can also be mapped at 0x4000-0x7fff
+class Mbc5Cartridge : public Cartridge
+{
+public:
+	Mbc5Cartridge(std::shared_ptr<const RomImage> rom, int ramBanks);
+
+	void RomWriteByte(unsigned short address, unsigned char value) override;
+};
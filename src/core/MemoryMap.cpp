@@ -1,135 +1,353 @@
 #include "stdafx.h"
 #include "MemoryMap.h"
 
-MemoryMap::MemoryMap(InputJoypad& joypad) : _graphics(nullptr), _timer(nullptr), _joypad(joypad)
+MemoryMap::MemoryMap(InputJoypad& joypad) : _graphics(nullptr), _joypad(joypad)
 {
+	_readPages.fill(nullptr);
+	_writePages.fill(nullptr);
+	_watchedPages.fill(0);
+
+	_ioPorts.fill({ nullptr, nullptr, nullptr });
+	_interruptEnablePort = { nullptr, nullptr, nullptr };
+
+	MapIoPort(JoypadPort, &_joypad,
+		[](void* joypad, unsigned short address) { return static_cast<InputJoypad*>(joypad)->ReadRegister(); },
+		[](void* joypad, unsigned short address, unsigned char value) { static_cast<InputJoypad*>(joypad)->WriteRegister(value); });
+
+	MapIoPort(InternalRomDisable, this, nullptr, [](void* memoryMap, unsigned short address, unsigned char value)
+	{
+		auto& map = *static_cast<MemoryMap*>(memoryMap);
+
+		map._internalRomEnabled &= !value;
+		map.MapRom();
+	});
+
+	MapWorkRam();
 }
 
 MemoryMap::~MemoryMap()
 {
 }
 
-unsigned char MemoryMap::ReadByte(unsigned short address) const
+void MemoryMap::MapPages(unsigned short address, size_t size, const unsigned char* readMemory, unsigned char* writeMemory)
 {
-	if (address < RamVideo)
+	for (size_t offset = 0; offset < size; offset += PageSize)
 	{
-		return _internalRomEnabled && address < 0x100
-			? _internalRom.ReadByte(address)
-			: _cartridge->RomReadByte(address);
-	}
+		auto page = (address + offset) / PageSize;
 
-	if (address < RamSwitched)
-	{
-		return _graphics->Vram(address - RamVideo);
-	}
+		// Accesses of the kinds watched on a page, and all accesses while OAM DMA runs, go through the decoder
+		auto watched = _oamDmaActive ? static_cast<unsigned char>(WatchAccess::ReadWrite) : _watchedPages[page];
 
-	if (address < RamFixed)
-	{
-		return _cartridge->RamReadByte(address - RamSwitched);
+		_readPages[page] = readMemory != nullptr && (watched & static_cast<int>(WatchAccess::Read)) == 0 ? readMemory + offset : nullptr;
+		_writePages[page] = writeMemory != nullptr && (watched & static_cast<int>(WatchAccess::Write)) == 0 ? writeMemory + offset : nullptr;
 	}
+}
 
+void MemoryMap::MapRom()
+{
+	if (_cartridge == nullptr) return;
+
+	// Writes to ROM control the cartridge's memory bank controller, so always go through the decoder
+	MapPages(RomFixed, RomBankSize, _cartridge->GetLowerRom(), nullptr);
+	MapPages(RomSwitched, RomBankSize, _cartridge->GetSelectedRom(), nullptr);
+
+	if (_internalRomEnabled) MapPages(RomFixed, GbInternalRom::Size, _internalRom.Data(), nullptr);
+}
+
+void MemoryMap::MapCartridgeRam()
+{
+	auto ram = _cartridge != nullptr ? _cartridge->GetSelectedRam() : nullptr;
+
+	// Writes to RAM kept in a save file go through the cartridge, so that it can track what to flush
+	MapPages(RamSwitched, RamBankSize, ram, ram != nullptr && !_cartridge->IsRamPersistent() ? ram : nullptr);
+}
+
+void MemoryMap::MapWorkRam()
+{
 	// Includes near-complete repeat of fixed RAM from 0xe000 to OAM RAM start
-	if (address < RamOam)
+	MapPages(RamFixed, RamBankSize, _fixedRam, _fixedRam);
+	MapPages(RamFixed + RamBankSize, RamOam - RamFixed - RamBankSize, _fixedRam, _fixedRam);
+}
+
+void MemoryMap::MapVram(unsigned char* vram)
+{
+	_vram = vram;
+
+	// Writes go through Graphics, so that it can track what changed
+	MapPages(RamVideo, RamSwitched - RamVideo, vram, nullptr);
+}
+
+void MemoryMap::MapAll()
+{
+	MapRom();
+	MapVram(_vram);
+	MapCartridgeRam();
+	MapWorkRam();
+}
+
+void MemoryMap::StartOamDma(unsigned char sourcePage)
+{
+	// Sources from 0xe000 up read work RAM, as with its echo
+	if (sourcePage >= (RamFixed + RamBankSize) >> 8) sourcePage -= RamBankSize >> 8;
+
+	// Almost always a single memcpy from mapped RAM or ROM, but sources accessed through the decoder
+	// (or any source while another transfer is blocking memory) are gathered a byte at a time
+	unsigned char buffer[Graphics::OamSize];
+	auto source = _readPages[sourcePage];
+
+	if (source == nullptr)
 	{
-		return _fixedRam[address & 0x1fff];
+		for (unsigned short i = 0; i < Graphics::OamSize; i++) buffer[i] = ReadUnwatchedByte(sourcePage << 8 | i);
+		source = buffer;
 	}
 
-	if (address < UnusableArea1)
+	_graphics->LoadOam(source);
+
+	if (_cycleCounter == nullptr) return;
+
+	_oamDmaActive = true;
+	_oamDmaEndCycle = *_cycleCounter + OamDmaCycles;
+	MapAll();
+}
+
+bool MemoryMap::OamDmaBlocks()
+{
+	if (*_cycleCounter < _oamDmaEndCycle) return true;
+
+	_oamDmaActive = false;
+	MapAll();
+
+	return false;
+}
+
+void MemoryMap::SetGraphics(Graphics* graphics)
+{
+	_graphics = graphics;
+
+	for (auto address = VramRegisters; address < UnusableArea2; address++)
 	{
-		return _graphics->ReadOam(address - RamOam);
+		MapIoPort(address, graphics,
+			[](void* graphics, unsigned short address) { return static_cast<Graphics*>(graphics)->ReadRegister(address - VramRegisters); },
+			[](void* graphics, unsigned short address, unsigned char value) { static_cast<Graphics*>(graphics)->WriteRegister(address - VramRegisters, value); });
 	}
+}
 
-	if (address < IoPorts)
+void MemoryMap::SetTimer(Timer* timer)
+{
+	for (auto address = TimerPorts; address < AfterTimerPorts; address++)
 	{
-		// Unused area from 0xfea0 to 0xfeff
-		return 0;
+		MapIoPort(address, timer,
+			[](void* timer, unsigned short address) { return static_cast<Timer*>(timer)->ReadRegister(address - TimerPorts); },
+			[](void* timer, unsigned short address, unsigned char value) { static_cast<Timer*>(timer)->WriteRegister(address - TimerPorts, value); });
 	}
+}
 
-	if (address < TimerPorts)
-	{
-		if (address == JoypadPort) return _joypad.ReadRegister();
+void MemoryMap::MapIoPort(unsigned short address, void* device, IoReadHandler read, IoWriteHandler write)
+{
+	GetIoPort(address) = { device, read, write };
+}
 
-		// TODO: IO ports
-		return 0xff;
-	}
+bool MemoryMap::AddWatchpoint(unsigned short address, WatchAccess access)
+{
+	if (address >= RamFixed + RamBankSize && address < RamOam) address -= RamBankSize;
 
-	if (address < AfterTimerPorts)
+	if (!(address >= RamSwitched && address < RamFixed + RamBankSize) && !(address >= HighRam && address != InterruptEnablePort))
 	{
-		return _timer->ReadRegister(address - TimerPorts);
+		return false;
 	}
 
-	if (address < VramRegisters)
+	_watchpoints[address] = access;
+	UpdateWatchedPages();
+
+	return true;
+}
+
+void MemoryMap::RemoveWatchpoint(unsigned short address)
+{
+	if (address >= RamFixed + RamBankSize && address < RamOam) address -= RamBankSize;
+
+	_watchpoints.erase(address);
+	UpdateWatchedPages();
+}
+
+void MemoryMap::ClearWatchpoints()
+{
+	_watchpoints.clear();
+	UpdateWatchedPages();
+}
+
+void MemoryMap::SetWatchHandler(void* observer, WatchHandler handler)
+{
+	_watchObserver = observer;
+	_watchHandler = handler;
+}
+
+void MemoryMap::UpdateWatchedPages()
+{
+	_watchedPages.fill(0);
+
+	for (auto& watchpoint : _watchpoints)
 	{
-		// TODO: IO ports
-		return 0xff;
+		auto address = watchpoint.first;
+		auto access = static_cast<unsigned char>(watchpoint.second);
+
+		_watchedPages[address >> 8] |= access;
+
+		// Work RAM is repeated up to OAM
+		if (address >= RamFixed && address + RamBankSize < RamOam) _watchedPages[(address + RamBankSize) >> 8] |= access;
 	}
 
-	if (address < UnusableArea2)
+	MapAll();
+
+	// Starting the range at the interrupt enable register, which it excludes, leaves it empty
+	auto highRamWatches = _watchedPages[HighRam >> 8];
+	_highRamReadStart = HighRam;
+	_highRamWriteStart = HighRam;
+
+	if ((highRamWatches & static_cast<int>(WatchAccess::Read)) != 0) _highRamReadStart = InterruptEnablePort;
+	if ((highRamWatches & static_cast<int>(WatchAccess::Write)) != 0) _highRamWriteStart = InterruptEnablePort;
+}
+
+void MemoryMap::ReportWatchedAccess(unsigned short address, unsigned char value, WatchAccess access) const
+{
+	auto watchedAddress = address >= RamFixed + RamBankSize && address < RamOam ? address - RamBankSize : address;
+	auto watchpoint = _watchpoints.find(static_cast<unsigned short>(watchedAddress));
+
+	if (watchpoint != _watchpoints.end() && (static_cast<int>(watchpoint->second) & static_cast<int>(access)) != 0 && _watchHandler != nullptr)
 	{
-		return _graphics->ReadRegister(address - VramRegisters);
+		_watchHandler(_watchObserver, address, value, access);
 	}
+}
 
-	if (address < HighRam)
+void MemoryMap::SetCartridge(std::shared_ptr<Cartridge> cartridge)
+{
+	_cartridge = cartridge;
+
+	MapRom();
+	MapCartridgeRam();
+}
+
+int MemoryMap::GetCodeBank(unsigned short address) const
+{
+	// Code is fetched through ReadByte while OAM DMA may be blocking it
+	if (_oamDmaActive && address < IoPorts) return UncachedCodeBank;
+
+	if (address < RomSwitched)
 	{
-		return 0;
+		return _internalRomEnabled && address < GbInternalRom::Size ? InternalRomCodeBank : _cartridge->GetLowerRomBank();
 	}
 
-	return _highRam[address - HighRam];
+	if (address < RamVideo) return _cartridge->GetSelectedRomBank();
+
+	if (address >= RamFixed && address < RamFixed + RamBankSize) return WorkRamCodeBank;
+
+	if (address >= HighRam && address != 0xffff) return HighRamCodeBank;
+
+	return UncachedCodeBank;
+}
+
+unsigned char MemoryMap::ReadMappedByte(unsigned short address)
+{
+	if (_oamDmaActive && address < IoPorts && OamDmaBlocks()) return OpenBus;
+
+	auto value = ReadUnwatchedByte(address);
+
+	if ((_watchedPages[address >> 8] & static_cast<int>(WatchAccess::Read)) != 0) ReportWatchedAccess(address, value, WatchAccess::Read);
+
+	return value;
 }
 
-void MemoryMap::WriteByte(unsigned short address, unsigned char value)
+unsigned char MemoryMap::ReadUnwatchedByte(unsigned short address) const
 {
+	// The I/O ports are checked first as they're the bulk of what gets here; memory is mostly paged
+	if (address >= IoPorts)
+	{
+		if (address >= HighRam && address != InterruptEnablePort) return _highRam[address - HighRam];
+
+		auto& port = GetIoPort(address);
+		return port.Read != nullptr ? port.Read(port.Device, address) : OpenBus;
+	}
+
 	if (address < RamVideo)
 	{
-		// Writing to ROM area. Used to switch the cartridge's memory banks
-		_cartridge->RomWriteByte(address, value);
+		return _internalRomEnabled && address < 0x100
+			? _internalRom.ReadByte(address)
+			: _cartridge->RomReadByte(address);
 	}
-	else if (address < RamSwitched)
+
+	if (address < RamSwitched)
 	{
-		_graphics->Vram(address - RamVideo) = value;
+		return _graphics->Vram(address - RamVideo);
 	}
-	else if (address < RamFixed)
+
+	if (address < RamFixed)
 	{
-		_cartridge->RamWriteByte(address - RamFixed, value);
+		return _cartridge->RamReadByte(address - RamSwitched);
 	}
+
 	// Includes near-complete repeat of fixed RAM from 0xe000 to OAM RAM start
-	else if (address < RamOam)
+	if (address < RamOam)
 	{
-		_fixedRam[address & 0x1fff] = value;
+		return _fixedRam[address & 0x1fff];
 	}
-	else if (address < UnusableArea1)
+
+	if (address < UnusableArea1)
 	{
-		_graphics->WriteOam(address - RamOam, value);
+		return _graphics->ReadOam(address - RamOam);
 	}
-	else if (address < IoPorts)
+
+	// Unused area from 0xfea0 to 0xfeff
+	return 0;
+}
+
+void MemoryMap::WriteMappedByte(unsigned short address, unsigned char value)
+{
+	// As for reads, the I/O ports come first
+	if (address >= IoPorts)
 	{
-		// Writing to undocumented address space
+		if (address >= HighRam && address != InterruptEnablePort)
+		{
+			_highRam[address - HighRam] = value;
+		}
+		else
+		{
+			auto& port = GetIoPort(address);
+			if (port.Write != nullptr) port.Write(port.Device, address, value);
+		}
 	}
-	else if (address < TimerPorts)
+	else if (_oamDmaActive && OamDmaBlocks())
 	{
-		if (address == JoypadPort) _joypad.WriteRegister(value);
+		return;
+	}
+	else if (address < RamVideo)
+	{
+		// Writing to ROM area. Used to switch the cartridge's memory banks
+		_cartridge->RomWriteByte(address, value);
 
-		// TODO: I/O ports
+		MapRom();
+		MapCartridgeRam();
 	}
-	else if (address < AfterTimerPorts)
+	else if (address < RamSwitched)
 	{
-		_timer->WriteRegister(address - TimerPorts, value);
+		_graphics->WriteVram(address - RamVideo, value);
 	}
-	else if (address < VramRegisters)
+	else if (address < RamFixed)
 	{
-		// TODO: I/O ports
+		_cartridge->RamWriteByte(address - RamSwitched, value);
 	}
-	else if (address < UnusableArea2)
+	// Includes near-complete repeat of fixed RAM from 0xe000 to OAM RAM start
+	else if (address < RamOam)
 	{
-		_graphics->WriteRegister(address - VramRegisters, value);
+		_fixedRam[address & 0x1fff] = value;
 	}
-	else if (address < HighRam)
+	else if (address < UnusableArea1)
 	{
-		// Writing to undocumented address space (excluding internal ROM disable)
-		if (address == 0xff50) _internalRomEnabled &= !value;
+		_graphics->WriteOam(address - RamOam, value);
 	}
 	else
 	{
-		_highRam[address - HighRam] = value;
+		// Writing to undocumented address space
 	}
+
+	if ((_watchedPages[address >> 8] & static_cast<int>(WatchAccess::Write)) != 0) ReportWatchedAccess(address, value, WatchAccess::Write);
 }
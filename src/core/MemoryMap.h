@@ -1,11 +1,36 @@
 #pragma once
+#include <array>
+#include <cstdint>
 #include <memory>
+#include <unordered_map>
 #include "Cartridge.h"
 #include "GbInternalRom.h"
 #include "Graphics.h"
 #include "Timer.h"
 #include "InputJoypad.h"
 
+// Handlers for an I/O register, called with the device they were mapped for and the register's address
+typedef unsigned char(*IoReadHandler)(void* device, unsigned short address);
+typedef void(*IoWriteHandler)(void* device, unsigned short address, unsigned char value);
+
+struct IoPort
+{
+	void* Device;
+	IoReadHandler Read;
+	IoWriteHandler Write;
+};
+
+// Kinds of access reported by a watchpoint
+enum class WatchAccess : unsigned char
+{
+	Read = 1,
+	Write = 2,
+	ReadWrite = Read | Write
+};
+
+// Called for each access to a watched address, with the observer it was set for and the value read or written
+typedef void(*WatchHandler)(void* observer, unsigned short address, unsigned char value, WatchAccess access);
+
 class MemoryMap
 {
 public:
@@ -25,16 +50,32 @@ public:
 
 	static const size_t RomBankSize = 1 << 14;
 	static const size_t RamBankSize = 1 << 13;
+	static const size_t PageSize = 1 << 8;
+	static const size_t PageCount = 0x10000 / PageSize;
 
 	static const unsigned short JoypadPort = 0xff00;
+	static const unsigned short InterruptFlagPort = 0xff0f;
+	static const unsigned short OamDmaPort = 0xff46;
 	static const unsigned short InternalRomDisable = 0xff50;
+	static const unsigned short InterruptEnablePort = 0xffff;
+
+	// Value read from I/O registers that aren't mapped
+	static const unsigned char OpenBus = 0xff;
+
+	// Length of an OAM DMA transfer: one byte per machine cycle
+	static const int OamDmaCycles = 160 * 4;
 
 	static const unsigned short Joypad = 0xff00;
 
+	// Code bank identifiers returned by GetCodeBank (cartridge ROM banks are identified by bank number)
+	static const int UncachedCodeBank = -1;
+	static const int InternalRomCodeBank = 0x1000;
+	static const int WorkRamCodeBank = 0x1001;
+	static const int HighRamCodeBank = 0x1002;
+
 protected:
 	std::shared_ptr<Cartridge> _cartridge;
 	Graphics* _graphics;
-	Timer* _timer;
 	InputJoypad& _joypad;
 
 	unsigned char _fixedRam[RamBankSize];
@@ -43,15 +84,122 @@ protected:
 	GbInternalRom _internalRom;
 	bool _internalRomEnabled = true;
 
+	// Memory backing each 256-byte page, or null for pages accessed through the address decoder (I/O,
+	// OAM, writes to ROM and VRAM, and VRAM or cartridge RAM while they're inaccessible)
+	std::array<const unsigned char*, PageCount> _readPages;
+	std::array<unsigned char*, PageCount> _writePages;
+
+	// Handlers for each I/O register from 0xff00 to 0xff7f, and for the interrupt enable register
+	std::array<IoPort, HighRam - IoPorts> _ioPorts;
+	IoPort _interruptEnablePort;
+
+	// Watchpoints by address, with echo RAM folded onto work RAM, and the kinds of access watched on each
+	// page. Pages with a watch have no memory mapped for those kinds of access, so only their accesses
+	// reach the address decoder and get checked. High RAM isn't paged, so is diverted by moving where
+	// ReadByte/WriteByte's high RAM range starts instead
+	std::unordered_map<unsigned short, WatchAccess> _watchpoints;
+	std::array<unsigned char, PageCount> _watchedPages;
+	unsigned short _highRamReadStart = HighRam;
+	unsigned short _highRamWriteStart = HighRam;
+
+	void* _watchObserver = nullptr;
+	WatchHandler _watchHandler = nullptr;
+
+	// VRAM as last mapped by Graphics, or null while it's locked out
+	unsigned char* _vram = nullptr;
+
+	// While OAM DMA runs, nothing below the I/O ports is mapped, so that the CPU's accesses there reach
+	// the decoder and are blocked. The transfer ends on the first such access at or after _oamDmaEndCycle
+	const uint64_t* _cycleCounter = nullptr;
+	bool _oamDmaActive = false;
+	uint64_t _oamDmaEndCycle = 0;
+
+	// Returns true if OAM DMA is still blocking access, otherwise ends it and maps memory back
+	bool OamDmaBlocks();
+
+	IoPort& GetIoPort(unsigned short address) { return address < HighRam ? _ioPorts[address - IoPorts] : _interruptEnablePort; }
+	const IoPort& GetIoPort(unsigned short address) const { return address < HighRam ? _ioPorts[address - IoPorts] : _interruptEnablePort; }
+
+	void MapPages(unsigned short address, size_t size, const unsigned char* readMemory, unsigned char* writeMemory);
+
+	// Update the pages of memory that's switched by the cartridge or the internal ROM
+	void MapRom();
+	void MapCartridgeRam();
+	void MapWorkRam();
+	void MapAll();
+
+	// Recomputes _watchedPages from _watchpoints, and remaps the memory they cover
+	void UpdateWatchedPages();
+	void ReportWatchedAccess(unsigned short address, unsigned char value, WatchAccess access) const;
+
+	// Full address decoders, for pages with no memory mapped directly. Accesses to watched pages are reported
+	unsigned char ReadMappedByte(unsigned short address);
+	unsigned char ReadUnwatchedByte(unsigned short address) const;
+	void WriteMappedByte(unsigned short address, unsigned char value);
+
 public:
 	explicit MemoryMap(InputJoypad& joypad);
 	~MemoryMap();
 
-	void SetCartridge(std::shared_ptr<Cartridge> cartridge) { _cartridge = cartridge; }
-	void SetGraphics(Graphics* graphics) { _graphics = graphics; }
-	void SetTimer(Timer* timer) { _timer = timer; }
+	void SetCartridge(std::shared_ptr<Cartridge> cartridge);
+	void SetGraphics(Graphics* graphics);
+	void SetTimer(Timer* timer);
+
+	// Maps handlers for the I/O register at address (0xff00 to 0xff7f, or 0xffff). Reads of a register
+	// without a read handler return OpenBus, and writes to one without a write handler are ignored
+	void MapIoPort(unsigned short address, void* device, IoReadHandler read, IoWriteHandler write);
+
+	// Identifies the memory currently mapped at a code address, for keying decoded code. Returns
+	// UncachedCodeBank for I/O, video, OAM, cartridge RAM and echo RAM, whose code isn't cached
+	int GetCodeBank(unsigned short address) const;
+
+	// Maps VRAM pages directly to vram for reading while it's accessible to the CPU. Called by Graphics
+	// with null while VRAM is locked out, so that reads go through its lockout handling. Writes always do
+	void MapVram(unsigned char* vram);
+
+	// Adds a watchpoint reporting the given kinds of access to address, which must be in work RAM (where it
+	// also covers the echo), high RAM or cartridge RAM. Returns false for addresses anywhere else
+	bool AddWatchpoint(unsigned short address, WatchAccess access);
+	void RemoveWatchpoint(unsigned short address);
+	void ClearWatchpoints();
+
+	bool HasWatchpoints() const { return !_watchpoints.empty(); }
+
+	// Sets the handler called for each watched access. Set by the CPU to add its state to the report
+	void SetWatchHandler(void* observer, WatchHandler handler);
+
+	// Sets the CPU's total cycle count, used to time OAM DMA. Without one, transfers complete instantly
+	void SetCycleCounter(const uint64_t* cycleCounter) { _cycleCounter = cycleCounter; }
+
+	// Copies 160 bytes from sourcePage << 8 to OAM in one go, then blocks the CPU from everything but
+	// the I/O ports and high RAM for OamDmaCycles, counted from the start of the instruction writing
+	// the DMA register
+	void StartOamDma(unsigned char sourcePage);
+	bool IsOamDmaActive() const { return _oamDmaActive; }
+
+	unsigned char ReadByte(unsigned short address)
+	{
+		auto page = _readPages[address >> 8];
+		if (page != nullptr) return page[address & 0xff];
+
+		// High RAM shares its page with the I/O ports
+		return address >= _highRamReadStart && address != InterruptEnablePort ? _highRam[address - HighRam] : ReadMappedByte(address);
+	}
+
+	void WriteByte(unsigned short address, unsigned char value)
+	{
+		auto page = _writePages[address >> 8];
+
+		if (page != nullptr) page[address & 0xff] = value;
+		else if (address >= _highRamWriteStart && address != InterruptEnablePort) _highRam[address - HighRam] = value;
+		else WriteMappedByte(address, value);
+	}
 
-	unsigned char ReadByte(unsigned short address) const;
-	void WriteByte(unsigned short address, unsigned char value);
+	// Reads a byte without reporting it to watchpoints, for decoding code and inspecting memory
+	unsigned char PeekByte(unsigned short address) const
+	{
+		auto page = _readPages[address >> 8];
+		return page != nullptr ? page[address & 0xff] : ReadUnwatchedByte(address);
+	}
 };
 
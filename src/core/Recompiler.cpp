@@ -0,0 +1,305 @@
+#include "stdafx.h"
+#include "Recompiler.h"
+#include "MemoryMap.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	void Emit(std::vector<unsigned char>& code, std::initializer_list<unsigned char> bytes)
+	{
+		code.insert(code.end(), bytes);
+	}
+
+	template<typename T> void EmitValue(std::vector<unsigned char>& code, T value)
+	{
+		unsigned char bytes[sizeof(T)];
+		memcpy(bytes, &value, sizeof(T));
+		code.insert(code.end(), bytes, bytes + sizeof(T));
+	}
+
+	// Emits the ModRM/SIB/disp32 bytes addressing [r12 + offset]
+	void EmitCpuOperand(std::vector<unsigned char>& code, unsigned char reg, int offset)
+	{
+		Emit(code, { static_cast<unsigned char>(0x84 | reg << 3), 0x24 });
+		EmitValue(code, offset);
+	}
+
+	// Emits a rel32 jump or conditional jump with a target to be patched in later. Returns the position of the rel32
+	size_t EmitJump(std::vector<unsigned char>& code, std::initializer_list<unsigned char> opcode)
+	{
+		Emit(code, opcode);
+		EmitValue(code, 0);
+		return code.size() - 4;
+	}
+
+	void PatchJump(std::vector<unsigned char>& code, size_t position, size_t target)
+	{
+		auto rel = static_cast<int>(target - (position + 4));
+		memcpy(code.data() + position, &rel, 4);
+	}
+}
+
+Recompiler::Recompiler(const std::array<StepFunction, 256>& steps, const CpuLayout& layout)
+	: _steps(steps), _layout(layout), _codeBuffer(nullptr), _codeUsed(0), _generation(1)
+{
+}
+
+Recompiler::~Recompiler()
+{
+	if (_codeBuffer == nullptr) return;
+
+#ifdef _WIN32
+	VirtualFree(_codeBuffer, 0, MEM_RELEASE);
+#else
+	munmap(_codeBuffer, CodeBufferSize);
+#endif
+}
+
+bool Recompiler::IsSupported()
+{
+#ifdef RECOMPILER_X64
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool Recompiler::IsIoHeavy(const DecodedBlock& block)
+{
+	auto ioAccesses = 0;
+
+	for (auto& instruction : block.Instructions)
+	{
+		switch (instruction.Opcode)
+		{
+		// LDH (n),A / LDH A,(n) / LD (C),A / LD A,(C)
+		case 0xe0: case 0xf0: case 0xe2: case 0xf2:
+			ioAccesses++;
+			break;
+
+		// LD (nn),A / LD A,(nn) into the I/O page
+		case 0xea: case 0xfa:
+			if (instruction.Operands[1] == 0xff) ioAccesses++;
+			break;
+		}
+	}
+
+	// Registers behind I/O accesses change underneath the CPU, so blocks doing much of it are
+	// typically polling loops that gain little from compilation and are left to the interpreter
+	return ioAccesses * 4 >= static_cast<int>(block.Instructions.size());
+}
+
+bool Recompiler::HasInvalidOpcode(const DecodedBlock& block)
+{
+	for (auto& instruction : block.Instructions)
+	{
+		if (DecodedBlockCache::IsInvalidOpcode(instruction.Opcode)) return true;
+	}
+
+	return false;
+}
+
+bool Recompiler::ProtectCode(size_t offset, size_t size, bool executable)
+{
+	const size_t PageSize = 1 << 12;
+
+	auto start = offset & ~(PageSize - 1);
+	auto end = (offset + size + PageSize - 1) & ~(PageSize - 1);
+
+#ifdef _WIN32
+	DWORD oldProtection;
+	if (VirtualProtect(_codeBuffer + start, end - start, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &oldProtection) == 0) return false;
+	if (executable) FlushInstructionCache(GetCurrentProcess(), _codeBuffer + start, end - start);
+	return true;
+#else
+	return mprotect(_codeBuffer + start, end - start, executable ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+bool Recompiler::EmitNativeInstruction(std::vector<unsigned char>& code, const DecodedInstruction& instruction) const
+{
+	auto opcode = instruction.Opcode;
+	int length, cycles;
+
+	if (opcode == 0x00)
+	{
+		// NOP
+		length = 1;
+		cycles = 4;
+	}
+	else if ((opcode & 0xc0) == 0x40 && (opcode & 0x7) != 6 && (opcode & 0x38) != 0x30)
+	{
+		// LD r,r': mov al,[src]; mov [dest],al
+		Emit(code, { 0x41, 0x8a });
+		EmitCpuOperand(code, 0, _layout.Reg8[opcode & 0x7]);
+		Emit(code, { 0x41, 0x88 });
+		EmitCpuOperand(code, 0, _layout.Reg8[(opcode >> 3) & 0x7]);
+
+		length = 1;
+		cycles = 4;
+	}
+	else if ((opcode & 0xc7) == 0x06 && opcode != 0x36)
+	{
+		// LD r,n: mov byte [dest],n
+		Emit(code, { 0x41, 0xc6 });
+		EmitCpuOperand(code, 0, _layout.Reg8[(opcode >> 3) & 0x7]);
+		Emit(code, { instruction.Operands[0] });
+
+		length = 2;
+		cycles = 8;
+	}
+	else
+	{
+		return false;
+	}
+
+	// mov word [PC],next; add qword [total cycles],cycles; add ebx,cycles
+	Emit(code, { 0x66, 0x41, 0xc7 });
+	EmitCpuOperand(code, 0, _layout.PC);
+	EmitValue(code, static_cast<unsigned short>(instruction.Address + length));
+
+	Emit(code, { 0x49, 0x83 });
+	EmitCpuOperand(code, 0, _layout.TotalCycles);
+	Emit(code, { static_cast<unsigned char>(cycles) });
+
+	Emit(code, { 0x83, 0xc3, static_cast<unsigned char>(cycles) });
+
+	return true;
+}
+
+void Recompiler::EmitStepCall(std::vector<unsigned char>& code, const DecodedInstruction& instruction) const
+{
+	// Pass the Cpu (held in r12) and the decoded instruction as the first two arguments
+#ifdef _WIN32
+	Emit(code, { 0x4c, 0x89, 0xe1, 0x48, 0xba });
+#else
+	Emit(code, { 0x4c, 0x89, 0xe7, 0x48, 0xbe });
+#endif
+	EmitValue(code, reinterpret_cast<uint64_t>(&instruction));
+
+	// mov rax,step; call rax
+	Emit(code, { 0x48, 0xb8 });
+	EmitValue(code, reinterpret_cast<uint64_t>(_steps[instruction.Opcode]));
+	Emit(code, { 0xff, 0xd0 });
+}
+
+Recompiler::NativeBlock Recompiler::Compile(const DecodedBlock& block)
+{
+#ifdef RECOMPILER_X64
+	std::vector<unsigned char> code;
+	std::vector<size_t> exitJumps;
+	std::vector<size_t> stopJumps;
+
+	// Keeps the Cpu in r12, the cycle budget in r13d and cycles run in ebx, all callee-saved on
+	// both calling conventions. Also reserves the shadow space Win64 needs below the calls
+	Emit(code, { 0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x83, 0xec, 0x20 });
+#ifdef _WIN32
+	Emit(code, { 0x49, 0x89, 0xcc, 0x41, 0x89, 0xd5 });
+#else
+	Emit(code, { 0x49, 0x89, 0xfc, 0x41, 0x89, 0xf5 });
+#endif
+	Emit(code, { 0x31, 0xdb });
+
+	for (auto& instruction : block.Instructions)
+	{
+		if (!EmitNativeInstruction(code, instruction))
+		{
+			EmitStepCall(code, instruction);
+
+			// test eax,eax; js stop; add ebx,eax
+			Emit(code, { 0x85, 0xc0 });
+			stopJumps.push_back(EmitJump(code, { 0x0f, 0x88 }));
+			Emit(code, { 0x01, 0xc3 });
+		}
+
+		if (&instruction != &block.Instructions.back())
+		{
+			// cmp ebx,r13d; jge exit
+			Emit(code, { 0x44, 0x39, 0xeb });
+			exitJumps.push_back(EmitJump(code, { 0x0f, 0x8d }));
+		}
+	}
+
+	// Exit: mov eax,ebx, then unwind the prologue
+	auto exit = code.size();
+	for (auto jump : exitJumps) PatchJump(code, jump, exit);
+	Emit(code, { 0x89, 0xd8, 0x48, 0x83, 0xc4, 0x20, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3 });
+
+	// Stop: not eax; add ebx,eax; jmp exit
+	auto stop = code.size();
+	for (auto jump : stopJumps) PatchJump(code, jump, stop);
+	Emit(code, { 0xf7, 0xd0, 0x01, 0xc3 });
+	PatchJump(code, EmitJump(code, { 0xe9 }), exit);
+
+	if (_codeBuffer == nullptr)
+	{
+#ifdef _WIN32
+		_codeBuffer = static_cast<unsigned char*>(VirtualAlloc(nullptr, CodeBufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#else
+		auto buffer = mmap(nullptr, CodeBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		_codeBuffer = buffer != MAP_FAILED ? static_cast<unsigned char*>(buffer) : nullptr;
+#endif
+		if (_codeBuffer == nullptr) return nullptr;
+	}
+
+	if (_codeUsed + code.size() > CodeBufferSize) Clear();
+
+	// Pages holding earlier blocks are executable, so are made writable just while the block is copied in.
+	// Compiled code only runs on this thread, and not while a block is being compiled
+	auto nativeCode = _codeBuffer + _codeUsed;
+	if (!ProtectCode(_codeUsed, code.size(), false)) return nullptr;
+	memcpy(nativeCode, code.data(), code.size());
+	if (!ProtectCode(_codeUsed, code.size(), true)) return nullptr;
+
+	// Keep blocks 16-byte aligned
+	_codeUsed += (code.size() + 15) & ~static_cast<size_t>(15);
+
+	return reinterpret_cast<NativeBlock>(nativeCode);
+#else
+	return nullptr;
+#endif
+}
+
+Recompiler::NativeBlock Recompiler::GetNativeCode(DecodedBlock& block)
+{
+	if (block.NativeCode != nullptr && block.NativeGeneration == _generation)
+	{
+		return reinterpret_cast<NativeBlock>(block.NativeCode);
+	}
+
+	if (block.Executions == NotCompilable || ++block.Executions < HotThreshold) return nullptr;
+
+	auto bank = static_cast<int>(block.Key >> 16);
+
+	// Code in RAM may be self-modifying, so is always interpreted
+	if (!IsSupported() || bank == MemoryMap::WorkRamCodeBank || bank == MemoryMap::HighRamCodeBank || IsIoHeavy(block) || HasInvalidOpcode(block))
+	{
+		block.Executions = NotCompilable;
+		return nullptr;
+	}
+
+	auto nativeCode = Compile(block);
+
+	if (nativeCode == nullptr)
+	{
+		block.Executions = NotCompilable;
+		return nullptr;
+	}
+
+	block.NativeCode = reinterpret_cast<void*>(nativeCode);
+	block.NativeGeneration = _generation;
+
+	return nativeCode;
+}
+
+void Recompiler::Clear()
+{
+	_codeUsed = 0;
+	_generation++;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "DecodedBlockCache.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define RECOMPILER_X64
+#endif
+
+// Translates hot decoded blocks into x86-64 code. Register moves and immediate loads are emitted
+// natively, every other instruction becomes a direct call to its specialised handler followed by
+// cycle budget and interrupt checks, so that compiled code keeps exact cycle accounting. On other
+// architectures nothing is ever compiled and the CPU falls back to the threaded interpreter
+class Recompiler
+{
+public:
+	// Runs a single instruction with its operands taken from the decoded instruction. Returns cycles
+	// elapsed, or their complement if the compiled block must be left after the instruction
+	typedef int(*StepFunction)(void* cpu, const DecodedInstruction* instruction);
+
+	// Entry point of a compiled block. Runs until the block ends or cycleBudget is used up, and returns cycles elapsed
+	typedef int(*NativeBlock)(void* cpu, int cycleBudget);
+
+	// Byte offsets of CPU state accessed directly by native code, relative to the Cpu object
+	struct CpuLayout
+	{
+		// 8-bit registers in opcode encoding order. Index 6 is (HL) and is unused
+		std::array<int, 8> Reg8;
+		int PC;
+		int TotalCycles;
+	};
+
+private:
+	static const int HotThreshold = 16;
+	static const int NotCompilable = -1;
+	static const size_t CodeBufferSize = 4 << 20;
+
+	const std::array<StepFunction, 256>& _steps;
+	const CpuLayout _layout;
+
+	unsigned char* _codeBuffer;
+	size_t _codeUsed;
+
+	// Bumped whenever the code buffer is recycled, invalidating all native code handed out before
+	unsigned int _generation;
+
+	static bool IsIoHeavy(const DecodedBlock& block);
+	static bool HasInvalidOpcode(const DecodedBlock& block);
+
+	// Switches the pages of the code buffer spanning size bytes from offset between writable and
+	// executable. The buffer is never both at once
+	bool ProtectCode(size_t offset, size_t size, bool executable);
+
+	bool EmitNativeInstruction(std::vector<unsigned char>& code, const DecodedInstruction& instruction) const;
+	void EmitStepCall(std::vector<unsigned char>& code, const DecodedInstruction& instruction) const;
+
+	NativeBlock Compile(const DecodedBlock& block);
+
+public:
+	Recompiler(const std::array<StepFunction, 256>& steps, const CpuLayout& layout);
+	~Recompiler();
+
+	Recompiler(const Recompiler&) = delete;
+	Recompiler& operator=(const Recompiler&) = delete;
+
+	static bool IsSupported();
+
+	// Gets native code for the block, compiling it once it has been run often enough. Returns null while
+	// the block is cold, or if it's RAM-resident or I/O-heavy and so is better left to the interpreter.
+	// Blocks with an invalid opcode are never compiled, as its exception can't unwind through native code
+	NativeBlock GetNativeCode(DecodedBlock& block);
+
+	// Discards all native code
+	void Clear();
+};
@@ -0,0 +1,53 @@
+#include "stdafx.h"
+#include "RomImage.h"
+#include <fstream>
+
+RomImage::RomImage(std::vector<unsigned char>&& bytes) : _buffer{ std::move(bytes) }, _data(_buffer.data()), _size(_buffer.size())
+{
+	PadAndParseHeader();
+}
+
+RomImage::RomImage(std::unique_ptr<MappedFile> file) : _file{ std::move(file) }, _data(_file->Data()), _size(_file->Size())
+{
+	PadAndParseHeader();
+}
+
+void RomImage::PadAndParseHeader()
+{
+	auto loadedSize = _size;
+
+	if (_size < MinimumSize)
+	{
+		// A mapping ends with the file, so reads beyond it would fault
+		if (_file != nullptr)
+		{
+			_buffer.assign(_data, _data + _size);
+			_file.reset();
+		}
+
+		_buffer.resize(MinimumSize);
+		_data = _buffer.data();
+		_size = _buffer.size();
+	}
+
+	// Padding isn't part of the ROM, so mustn't be taken for a header
+	_header = CartridgeHeader::Parse(_data, loadedSize);
+}
+
+std::shared_ptr<const RomImage> RomImage::LoadFromFile(const std::string& filePath)
+{
+	auto file = MappedFile::Open(filePath);
+	if (file != nullptr) return std::make_shared<const RomImage>(std::move(file));
+
+	std::ifstream ifs(filePath, std::ios::binary | std::ios::ate);
+	if (!ifs) return nullptr;
+
+	auto pos = ifs.tellg();
+
+	auto buffer = std::vector<unsigned char>(static_cast<int>(pos));
+
+	ifs.seekg(0, std::ios::beg);
+	ifs.read(reinterpret_cast<char*>(buffer.data()), pos);
+
+	return std::make_shared<const RomImage>(std::move(buffer));
+}
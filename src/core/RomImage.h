@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CartridgeHeader.h"
+#include "MappedFile.h"
+
+// Immutable contents of a cartridge ROM, either mapped from the ROM file or held in memory. Never changes
+// once created, so a single image can be shared by the cartridges of any number of emulators at once
+class RomImage
+{
+public:
+	static const size_t BankSize = 1 << 14;
+
+	// Both ROM areas are always mapped, so images smaller than this are copied into a buffer of this
+	// size, padded with zeros
+	static const size_t MinimumSize = BankSize * 2;
+
+protected:
+	std::vector<unsigned char> _buffer;
+	std::unique_ptr<MappedFile> _file;
+
+	const unsigned char* _data;
+	size_t _size;
+
+	std::unique_ptr<const CartridgeHeader> _header;
+
+	// Pads a short image out to MinimumSize, then parses the header from the bytes originally loaded
+	void PadAndParseHeader();
+
+public:
+	explicit RomImage(std::vector<unsigned char>&& bytes);
+	explicit RomImage(std::unique_ptr<MappedFile> file);
+
+	RomImage(const RomImage&) = delete;
+	RomImage& operator=(const RomImage&) = delete;
+
+	// Maps the ROM file at filePath, falling back to reading it into memory where it can't be mapped.
+	// Returns null if the file can't be read
+	static std::shared_ptr<const RomImage> LoadFromFile(const std::string& filePath);
+
+	// Contents of the image, including any padding
+	const unsigned char* Data() const { return _data; }
+	size_t Size() const { return _size; }
+
+	// Header parsed when the image was created, so cartridges sharing the image don't parse it again
+	// (or sum the ROM more than once for its global checksum). Null if the ROM is too small to have a header
+	const CartridgeHeader* GetHeader() const { return _header.get(); }
+
+	// Memory backing a 16KB bank. Bank numbers beyond the end of the ROM wrap around, as the bank lines
+	// of a memory bank controller that aren't connected are ignored
+	const unsigned char* GetBank(int bank) const
+	{
+		auto bankCount = _size > BankSize ? _size / BankSize : 1;
+		return _data + bank % bankCount * BankSize;
+	}
+};
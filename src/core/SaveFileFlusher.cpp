@@ -0,0 +1,107 @@
+#include "stdafx.h"
+#include "SaveFileFlusher.h"
+#include "CartridgeRam.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+const std::chrono::milliseconds SaveFileFlusher::DefaultInterval{ 1000 };
+
+namespace
+{
+	struct FlusherState
+	{
+		std::mutex Mutex;
+		std::condition_variable Wake;
+		std::thread Thread;
+		std::vector<CartridgeRam*> Rams;
+
+		// RAM the thread is flushing right now, without the lock held. Remove waits on Flushed for it
+		CartridgeRam* Flushing = nullptr;
+		std::condition_variable Flushed;
+		std::chrono::milliseconds Interval{ SaveFileFlusher::DefaultInterval };
+
+		// Bumped when the thread is told to stop, so that a thread started after it isn't stopped too
+		unsigned int Generation = 0;
+	};
+
+	FlusherState& GetState()
+	{
+		static FlusherState state;
+		return state;
+	}
+
+	void RunFlusher(unsigned int generation)
+	{
+		auto& state = GetState();
+		std::unique_lock<std::mutex> lock(state.Mutex);
+
+		std::vector<CartridgeRam*> rams;
+
+		while (!state.Wake.wait_for(lock, state.Interval, [&] { return state.Generation != generation; }))
+		{
+			// Flushing waits on the disk, so the lock is let go for each flush, leaving Add and Remove free
+			// to run on the emulation thread. RAM removed in the meantime is skipped
+			rams = state.Rams;
+
+			for (auto ram : rams)
+			{
+				if (state.Generation != generation) return;
+				if (std::find(state.Rams.begin(), state.Rams.end(), ram) == state.Rams.end()) continue;
+
+				state.Flushing = ram;
+				lock.unlock();
+
+				ram->Flush();
+
+				lock.lock();
+				state.Flushing = nullptr;
+				state.Flushed.notify_all();
+			}
+		}
+	}
+}
+
+void SaveFileFlusher::Add(CartridgeRam* ram)
+{
+	auto& state = GetState();
+	std::lock_guard<std::mutex> lock(state.Mutex);
+
+	state.Rams.push_back(ram);
+	if (!state.Thread.joinable()) state.Thread = std::thread(RunFlusher, state.Generation);
+}
+
+void SaveFileFlusher::Remove(CartridgeRam* ram)
+{
+	auto& state = GetState();
+	std::thread stoppedThread;
+
+	{
+		std::unique_lock<std::mutex> lock(state.Mutex);
+		state.Rams.erase(std::remove(state.Rams.begin(), state.Rams.end(), ram), state.Rams.end());
+		state.Flushed.wait(lock, [&] { return state.Flushing != ram; });
+
+		if (state.Rams.empty() && state.Thread.joinable())
+		{
+			state.Generation++;
+			stoppedThread = std::move(state.Thread);
+		}
+	}
+
+	state.Wake.notify_all();
+	if (stoppedThread.joinable()) stoppedThread.join();
+}
+
+void SaveFileFlusher::SetInterval(std::chrono::milliseconds interval)
+{
+	auto& state = GetState();
+
+	{
+		std::lock_guard<std::mutex> lock(state.Mutex);
+		state.Interval = interval;
+	}
+
+	state.Wake.notify_all();
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <chrono>
+
+class CartridgeRam;
+
+// Writes dirty regions of every open save file back to disk from a single background thread, however
+// many cartridges are loaded. The thread runs while at least one save file is open
+class SaveFileFlusher
+{
+public:
+	static const std::chrono::milliseconds DefaultInterval;
+
+	static void Add(CartridgeRam* ram);
+
+	// Once this returns the flusher won't touch ram again. Only waits on the disk if ram is being flushed
+	static void Remove(CartridgeRam* ram);
+
+	// Sets how long save files are left between flushes
+	static void SetInterval(std::chrono::milliseconds interval);
+};
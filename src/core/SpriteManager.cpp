@@ -1,41 +1,54 @@
 #include "stdafx.h"
 #include "SpriteManager.h"
+#include <algorithm>
 
 
-SpriteManager::SpriteManager(): _currentScanline(0), _spriteHeight(NormalSpriteHeight)
+SpriteManager::SpriteManager(): _sprites(nullptr), _visibleSpriteCount(0), _currentScanline(0), _spriteHeight(NormalSpriteHeight)
 {
 }
 
 void SpriteManager::SetScanline(unsigned char scanline)
 {
-	// TODO: Test for excessive memory allocation/freeing in this method
-
 	_currentScanline = scanline;
-	_visibleSprites.clear();
+	_visibleSpriteCount = 0;
 
-	auto firstSpriteNotAbove = _yOrderedSprites.upper_bound(_currentScanline + SpriteYOffset - _spriteHeight);
-	auto firstSpriteBelow = _yOrderedSprites.upper_bound(_currentScanline + SpriteYOffset);
+	if (_sprites == nullptr) return;
 
-	for (auto sprite = firstSpriteNotAbove; sprite != firstSpriteBelow; ++sprite)
+	// Like the hardware's OAM scan, take the first sprites in OAM on this line up to the limit,
+	// insertion sorting them by X position. Ties stay in OAM order
+	for (auto i = 0; i < Graphics::SpriteCount && _visibleSpriteCount < MaxSpritesPerLine; i++)
 	{
-		_visibleSprites.insert(*sprite);
+		auto& sprite = _sprites[i];
+		if (sprite.YPos <= _currentScanline + SpriteYOffset - _spriteHeight || sprite.YPos > _currentScanline + SpriteYOffset) continue;
+
+		auto position = _visibleSpriteCount++;
+
+		for (; position > 0 && _visibleSprites[position - 1]->XPos > sprite.XPos; position--)
+		{
+			_visibleSprites[position] = _visibleSprites[position - 1];
+		}
+
+		_visibleSprites[position] = &sprite;
 	}
 }
 
-void SpriteManager::SpriteMoved(SpriteData& spriteData)
+void SpriteManager::SpriteMoved(const SpriteData& spriteData)
 {
-	_visibleSprites.get<1>().erase(spriteData.OrderedSpriteId());
-	_yOrderedSprites.get<1>().erase(spriteData.OrderedSpriteId());
+	auto end = _visibleSprites.begin() + _visibleSpriteCount;
+	auto sprite = std::find(_visibleSprites.begin(), end, &spriteData);
 
-	_yOrderedSprites.insert(&spriteData);
+	if (sprite != end)
+	{
+		std::copy(sprite + 1, end, sprite);
+		_visibleSpriteCount--;
+	}
 }
 
-unsigned char SpriteManager::GetSpriteColour(SpriteData& spriteData, int x, int y, unsigned char* vram) const
+unsigned char SpriteManager::GetSpriteColour(const SpriteData& spriteData, int x, int y, const TileCache& tiles) const
 {
 	auto patternX = x - spriteData.XPos + SpriteXOffset;
 	auto patternY = y - spriteData.YPos + SpriteYOffset;
 
-	if (spriteData.Flags & SpriteFlags::XFlip) patternX = SpriteWidth - 1 - patternX;
 	if (spriteData.Flags & SpriteFlags::YFlip) patternY = _spriteHeight - 1 - patternY;
 
 	auto patternNum = spriteData.PatternNum;
@@ -47,8 +60,6 @@ unsigned char SpriteManager::GetSpriteColour(SpriteData& spriteData, int x, int
 		patternY &= 0x7;
 	}
 
-	auto baseByte = Graphics::SpriteDataTableBase + patternNum * 16 + (patternY << 1);
-	auto bitShift = 7 - patternX % 8;
-
-	return vram[baseByte] >> bitShift & 0x1 | (vram[baseByte + 1] >> bitShift & 0x1) << 1;
+	// Sprite patterns are always taken from the first tile data table
+	return tiles.GetRow(Graphics::SpriteDataTableBase / Graphics::TileSize + patternNum, patternY, (spriteData.Flags & SpriteFlags::XFlip) != 0)[patternX];
 }
@@ -1,34 +1,9 @@
 #pragma once
 #include "Graphics.h"
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/multi_index/hashed_index.hpp>
-#include <boost/multi_index/member.hpp>
-#include <boost/multi_index/mem_fun.hpp>
-#include <boost/multi_index/composite_key.hpp>
-
-using namespace boost::multi_index;
-
-using VisibleSpriteContainer = multi_index_container<SpriteData*, indexed_by<
-	ordered_unique<composite_key<SpriteData,
-		member<SpriteData, unsigned char, &SpriteData::XPos>,
-		const_mem_fun<SpriteData, uintptr_t, &SpriteData::OrderedSpriteId>
-	>>,
-	hashed_unique<const_mem_fun<SpriteData, uintptr_t, &SpriteData::OrderedSpriteId>>
->>;
+#include <array>
 
 class SpriteManager
 {
-	VisibleSpriteContainer _visibleSprites;
-
-	multi_index_container<SpriteData*, indexed_by<
-		ordered_non_unique<member<SpriteData, unsigned char, &SpriteData::YPos>>,
-		hashed_unique<const_mem_fun<SpriteData, uintptr_t, &SpriteData::OrderedSpriteId>>
-	>> _yOrderedSprites;
-
-	unsigned char _currentScanline;
-	unsigned char _spriteHeight;
-
 public:
 
 	// GB hardware supports 10 sprites per scanline
@@ -41,19 +16,40 @@ public:
 	static const int SpriteXOffset = 8;
 	static const int SpriteYOffset = 16;
 
+	using VisibleSpriteArray = std::array<const SpriteData*, MaxSpritesPerLine>;
+
+private:
+	const SpriteData* _sprites;
+
+	// Sprites on the current scanline, ordered by X position and then OAM index
+	VisibleSpriteArray _visibleSprites;
+	int _visibleSpriteCount;
+
+	unsigned char _currentScanline;
+	unsigned char _spriteHeight;
+
+public:
 
 	SpriteManager();
 
 	void SetUseTallSprites(bool tallSprites) { _spriteHeight = tallSprites ? TallSpriteHeight : NormalSpriteHeight; }
 
-	const VisibleSpriteContainer& GetVisibleSprites() const { return _visibleSprites; }
+	// Sets the sprite attribute table sprites are picked from, Graphics::SpriteCount entries long
+	void SetSprites(const SpriteData* sprites) { _sprites = sprites; }
+
+	const VisibleSpriteArray& GetVisibleSprites() const { return _visibleSprites; }
+	int GetVisibleSpriteCount() const { return _visibleSpriteCount; }
 
 	void SetScanline(unsigned char scanline);
 
 	void NextScanline()	{ SetScanline(_currentScanline + 1); }
 
-	void SpriteMoved(SpriteData& spriteData);
+	// Drops a sprite whose position has changed from the current scanline until the next is picked
+	void SpriteMoved(const SpriteData& spriteData);
+
+	// Picks sprites for the current scanline again, after all of OAM has been replaced
+	void ReloadSprites() { SetScanline(_currentScanline); }
 
-	unsigned char GetSpriteColour(SpriteData& spriteData, int x, int y, unsigned char* vram) const;
+	unsigned char GetSpriteColour(const SpriteData& spriteData, int x, int y, const TileCache& tiles) const;
 };
 
@@ -0,0 +1,36 @@
+#include "stdafx.h"
+#include "TileCache.h"
+
+TileCache::TileCache()
+{
+	_staleTiles.set();
+}
+
+void TileCache::DecodeTile(int tile, const unsigned char* tileData)
+{
+	for (auto row = 0; row < TileHeight; row++)
+	{
+		// Bitplanes: low bits of the row's pixels, then high bits, leftmost pixel in bit 7
+		auto low = tileData[row * 2];
+		auto high = tileData[row * 2 + 1];
+
+		for (auto x = 0; x < TileWidth; x++)
+		{
+			auto bitShift = TileWidth - 1 - x;
+			auto colour = static_cast<unsigned char>((low >> bitShift & 0x1) | (high >> bitShift & 0x1) << 1);
+
+			_rows[tile][row][x] = colour;
+			_flippedRows[tile][row][TileWidth - 1 - x] = colour;
+		}
+	}
+}
+
+void TileCache::UpdateStale(const unsigned char* vram)
+{
+	for (auto tile = 0; tile < TileCount; tile++)
+	{
+		if (_staleTiles.test(tile)) DecodeTile(tile, vram + tile * TileSize);
+	}
+
+	_staleTiles.reset();
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <bitset>
+
+// Tile data from VRAM decoded to one colour index (0-3) per byte, so that drawing a pixel is a plain
+// load rather than a tile data lookup and a bitplane extraction. Rows are also kept mirrored for
+// X-flipped sprites. Tiles are marked stale as VRAM is written, and decoded again by Update
+class TileCache
+{
+public:
+	static const int TileCount = 384;
+	static const int TileWidth = 8;
+	static const int TileHeight = 8;
+	static const int TileSize = TileHeight * 2;
+
+private:
+	unsigned char _rows[TileCount][TileHeight][TileWidth];
+	unsigned char _flippedRows[TileCount][TileHeight][TileWidth];
+
+	std::bitset<TileCount> _staleTiles;
+
+	void DecodeTile(int tile, const unsigned char* tileData);
+
+public:
+	TileCache();
+
+	void Invalidate(int tile) { _staleTiles.set(tile); }
+
+	// Decodes tiles written since the last update from tile data at the start of VRAM
+	void Update(const unsigned char* vram)
+	{
+		if (_staleTiles.any()) UpdateStale(vram);
+	}
+
+	void UpdateStale(const unsigned char* vram);
+
+	// Colour indexes of a row of pixels, left to right, or right to left if flipped
+	const unsigned char* GetRow(int tile, int row) const { return _rows[tile][row]; }
+	const unsigned char* GetRow(int tile, int row, bool flipped) const { return flipped ? _flippedRows[tile][row] : _rows[tile][row]; }
+};
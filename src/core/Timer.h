@@ -1,7 +1,7 @@
 #pragma once
 #include <algorithm>
-
-class Cpu;
+#include <limits>
+#include "CpuFwd.h"
 
 // CPU HALT: Timer/Div keep running
 // CPU STOP: Timer/Div stop running
@@ -37,6 +37,13 @@ public:
 	Timer();
 	int GetCyclesToNextEvent() const { return std::max(0, _isRunning ? std::min(_cyclesToNextCounterInc, _cyclesToNextDivInc) : _cyclesToNextDivInc); }
 
+	// Gets cycles until the counter next overflows and requests an interrupt
+	int GetCyclesToNextInterrupt() const
+	{
+		return _isRunning ? std::max(0, _cyclesToNextCounterInc + (0xff - _registers[CounterReg]) * GetCyclesPerCounterInc())
+						  : std::numeric_limits<int>::max();
+	}
+
 	void RunCycles(int numCycles);
 
 	void SetCpu(Cpu* cpu) { _cpu = cpu; }
@@ -83,7 +90,8 @@ public:
 
 	unsigned char ReadRegister(int address)
 	{
-		return address < ControlReg ? _registers[address] : _divisorMode | (_isRunning ? 4 : 0);
+		// Unused control bits read as set
+		return address < ControlReg ? _registers[address] : 0xf8 | _divisorMode | (_isRunning ? 4 : 0);
 	}
 };
 
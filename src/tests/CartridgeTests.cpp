@@ -0,0 +1,423 @@
+#include "stdafx.h"
+#include <gtest/gtest.h>
+#include "../core/CartridgeFactory.h"
+#include "../core/MemoryMap.h"
+#include "../core/SaveFileFlusher.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <typeinfo>
+
+namespace
+{
+	// ROM of the given size with the cartridge type in its header, and each bank's number in its first two bytes
+	std::shared_ptr<const RomImage> MakeBankedRom(size_t banks, unsigned char cartridgeType, unsigned char ramSize = 0)
+	{
+		std::vector<unsigned char> rom(banks * RomImage::BankSize);
+
+		for (size_t bank = 0; bank < banks; bank++)
+		{
+			rom[bank * RomImage::BankSize] = static_cast<unsigned char>(bank);
+			rom[bank * RomImage::BankSize + 1] = static_cast<unsigned char>(bank >> 8);
+		}
+
+		rom[0x147] = cartridgeType;
+		rom[0x149] = ramSize;
+
+		return std::make_shared<const RomImage>(std::move(rom));
+	}
+
+	int SelectedRomBank(const Cartridge& cartridge)
+	{
+		return cartridge.RomReadByte(0x4000) | cartridge.RomReadByte(0x4001) << 8;
+	}
+}
+
+TEST(CartridgeTests, LoadFromFile)
+{
+	const std::string romPath = "../../ROMs/gb-snake.gb";
+
+	std::ifstream ifs(romPath, std::ios::binary);
+	std::vector<unsigned char> rom{ std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
+	ASSERT_FALSE(rom.empty());
+
+	auto cartridge = CartridgeFactory::LoadFromFile(romPath);
+	ASSERT_TRUE(cartridge != nullptr);
+
+	for (size_t bank = 0; bank < rom.size() / MemoryMap::RomBankSize; bank++)
+	{
+		EXPECT_EQ(0, memcmp(rom.data() + bank * MemoryMap::RomBankSize, cartridge->GetRom()->GetBank(static_cast<int>(bank)), MemoryMap::RomBankSize));
+	}
+
+	EXPECT_TRUE(CartridgeFactory::LoadFromFile("../../ROMs/missing.gb") == nullptr);
+}
+
+TEST(CartridgeTests, ShortRomImage)
+{
+	const std::string romPath = "CartridgeTests-short.gb";
+
+	// Header and a little code, far short of the two banks a cartridge maps
+	std::vector<unsigned char> rom(0x200, 0x3c);
+	rom[0x147] = 0x00;
+	rom[0x148] = 0x00;
+	{
+		std::ofstream ofs(romPath, std::ios::binary);
+		ofs.write(reinterpret_cast<const char*>(rom.data()), rom.size());
+	}
+
+	const auto minimumSize = RomImage::MinimumSize;
+
+	for (auto& image : { RomImage::LoadFromFile(romPath), std::make_shared<const RomImage>(std::vector<unsigned char>(rom)) })
+	{
+		ASSERT_TRUE(image != nullptr && image->GetHeader() != nullptr);
+		ASSERT_EQ(minimumSize, image->Size());
+
+		auto cartridge = CartridgeFactory::Create(image);
+		ASSERT_TRUE(cartridge != nullptr);
+
+		// Reads past the end of the ROM see the padding
+		EXPECT_EQ(0x3c, cartridge->RomReadByte(0x1ff));
+		EXPECT_EQ(0x00, cartridge->RomReadByte(0x200));
+		EXPECT_EQ(0x00, cartridge->RomReadByte(0x3fff));
+		EXPECT_EQ(0x00, cartridge->RomReadByte(0x7fff));
+	}
+
+	std::remove(romPath.c_str());
+}
+
+TEST(CartridgeTests, SharedRomImage)
+{
+	auto rom = RomImage::LoadFromFile("../../ROMs/gb-snake.gb");
+	ASSERT_TRUE(rom != nullptr);
+
+	Mbc1Cartridge cartridge1{ rom, 1 };
+	Mbc1Cartridge cartridge2{ rom, 1 };
+
+	EXPECT_EQ(3, rom.use_count());
+	EXPECT_EQ(cartridge1.GetSelectedRom(), cartridge2.GetSelectedRom());
+
+	// Bank controller state and RAM belong to each cartridge
+	cartridge1.RomWriteByte(0x0000, 0x0a);
+	cartridge1.RamWriteByte(0x10, 0x42);
+	cartridge2.RomWriteByte(0x0000, 0x0a);
+
+	EXPECT_EQ(0x42, cartridge1.RamReadByte(0x10));
+	EXPECT_EQ(0x00, cartridge2.RamReadByte(0x10));
+}
+
+TEST(CartridgeTests, MapperFromHeader)
+{
+	EXPECT_TRUE(typeid(*CartridgeFactory::Create(MakeBankedRom(2, 0x00))) == typeid(Cartridge));
+	EXPECT_TRUE(typeid(*CartridgeFactory::Create(MakeBankedRom(2, 0x03))) == typeid(Mbc1Cartridge));
+	EXPECT_TRUE(typeid(*CartridgeFactory::Create(MakeBankedRom(2, 0x06))) == typeid(Mbc2Cartridge));
+	EXPECT_TRUE(typeid(*CartridgeFactory::Create(MakeBankedRom(2, 0x10))) == typeid(Mbc3Cartridge));
+	EXPECT_TRUE(typeid(*CartridgeFactory::Create(MakeBankedRom(2, 0x1b))) == typeid(Mbc5Cartridge));
+
+	// HuC1 isn't emulated
+	EXPECT_TRUE(CartridgeFactory::Create(MakeBankedRom(2, 0xff)) == nullptr);
+	EXPECT_TRUE(CartridgeFactory::Create(std::make_shared<const RomImage>(std::vector<unsigned char>(0x100))) == nullptr);
+}
+
+TEST(CartridgeTests, Mbc1Banking)
+{
+	Mbc1Cartridge cartridge{ MakeBankedRom(128, 0x03), 4 };
+	EXPECT_EQ(1, SelectedRomBank(cartridge));
+
+	cartridge.RomWriteByte(0x2000, 0x05);
+	EXPECT_EQ(5, SelectedRomBank(cartridge));
+	EXPECT_EQ(cartridge.GetRom()->GetBank(5), cartridge.GetSelectedRom());
+
+	// Bank 0 selects bank 1, including with the upper bits set
+	cartridge.RomWriteByte(0x2000, 0x00);
+	EXPECT_EQ(1, SelectedRomBank(cartridge));
+	cartridge.RomWriteByte(0x4000, 0x02);
+	EXPECT_EQ(0x41, SelectedRomBank(cartridge));
+	EXPECT_EQ(0, cartridge.RomReadByte(0x0000));
+
+	// Mode 1 also applies the upper bits to the lower ROM area and selects the RAM bank
+	cartridge.RomWriteByte(0x0000, 0x0a);
+	cartridge.RomWriteByte(0x6000, 0x01);
+	EXPECT_EQ(0x40, cartridge.RomReadByte(0x0000));
+	EXPECT_EQ(0x40, cartridge.GetLowerRomBank());
+
+	cartridge.RamWriteByte(0x0000, 0x42);
+	cartridge.RomWriteByte(0x6000, 0x00);
+	EXPECT_EQ(0x00, cartridge.RamReadByte(0x0000));
+	cartridge.RomWriteByte(0x6000, 0x01);
+	EXPECT_EQ(0x42, cartridge.RamReadByte(0x0000));
+
+	// Disabled RAM reads as open bus and isn't mapped
+	cartridge.RomWriteByte(0x0000, 0x00);
+	EXPECT_EQ(0xff, cartridge.RamReadByte(0x0000));
+	EXPECT_TRUE(cartridge.GetSelectedRam() == nullptr);
+}
+
+TEST(CartridgeTests, Mbc2NibbleRam)
+{
+	Mbc2Cartridge cartridge{ MakeBankedRom(16, 0x06) };
+
+	// Address bit 8 selects the ROM bank register
+	cartridge.RomWriteByte(0x2100, 0x0b);
+	EXPECT_EQ(11, SelectedRomBank(cartridge));
+	cartridge.RomWriteByte(0x0100, 0x00);
+	EXPECT_EQ(1, SelectedRomBank(cartridge));
+
+	cartridge.RomWriteByte(0x0000, 0x0a);
+	cartridge.RamWriteByte(0x0010, 0xa5);
+	EXPECT_EQ(0xf5, cartridge.RamReadByte(0x0010));
+
+	// Repeated every 512 bytes
+	EXPECT_EQ(0xf5, cartridge.RamReadByte(0x1210));
+	EXPECT_TRUE(cartridge.GetSelectedRam() == nullptr);
+}
+
+TEST(CartridgeTests, Mbc3Rtc)
+{
+	Mbc3Cartridge cartridge{ MakeBankedRom(128, 0x10), 4 };
+
+	cartridge.RomWriteByte(0x2000, 0x7f);
+	EXPECT_EQ(0x7f, SelectedRomBank(cartridge));
+
+	cartridge.RomWriteByte(0x0000, 0x0a);
+	cartridge.RomWriteByte(0x4000, 0x03);
+	cartridge.RamWriteByte(0x0000, 0x42);
+	EXPECT_TRUE(cartridge.GetSelectedRam() != nullptr);
+
+	// Halt the clock so that it holds the values written
+	cartridge.RomWriteByte(0x4000, Mbc3Cartridge::RtcDayHigh);
+	EXPECT_TRUE(cartridge.GetSelectedRam() == nullptr);
+	cartridge.RamWriteByte(0x0000, 0x41);
+
+	const unsigned char values[] = { 59, 58, 23, 0xff };
+	for (auto rtcRegister = 0; rtcRegister < 4; rtcRegister++)
+	{
+		cartridge.RomWriteByte(0x4000, static_cast<unsigned char>(Mbc3Cartridge::RtcSeconds + rtcRegister));
+		cartridge.RamWriteByte(0x0000, values[rtcRegister]);
+	}
+
+	cartridge.RomWriteByte(0x6000, 0x00);
+	cartridge.RomWriteByte(0x6000, 0x01);
+
+	for (auto rtcRegister = 0; rtcRegister < 4; rtcRegister++)
+	{
+		cartridge.RomWriteByte(0x4000, static_cast<unsigned char>(Mbc3Cartridge::RtcSeconds + rtcRegister));
+		EXPECT_EQ(values[rtcRegister], cartridge.RamReadByte(0x0000));
+	}
+
+	cartridge.RomWriteByte(0x4000, Mbc3Cartridge::RtcDayHigh);
+	EXPECT_EQ(0x41, cartridge.RamReadByte(0x0000));
+
+	// Selecting RAM again maps it back in
+	cartridge.RomWriteByte(0x4000, 0x03);
+	EXPECT_EQ(0x42, cartridge.RamReadByte(0x0000));
+}
+
+TEST(CartridgeTests, Mbc5Banking)
+{
+	Mbc5Cartridge cartridge{ MakeBankedRom(512, 0x1b), 16 };
+
+	cartridge.RomWriteByte(0x2000, 0x00);
+	EXPECT_EQ(0, SelectedRomBank(cartridge));
+
+	cartridge.RomWriteByte(0x3000, 0x01);
+	EXPECT_EQ(0x100, SelectedRomBank(cartridge));
+	cartridge.RomWriteByte(0x2000, 0xff);
+	EXPECT_EQ(0x1ff, SelectedRomBank(cartridge));
+
+	cartridge.RomWriteByte(0x0000, 0x0a);
+	cartridge.RomWriteByte(0x4000, 0x0f);
+	cartridge.RamWriteByte(0x1fff, 0x42);
+	cartridge.RomWriteByte(0x4000, 0x00);
+	EXPECT_EQ(0x00, cartridge.RamReadByte(0x1fff));
+	cartridge.RomWriteByte(0x4000, 0x0f);
+	EXPECT_EQ(0x42, cartridge.RamReadByte(0x1fff));
+}
+
+TEST(CartridgeTests, ParseHeader)
+{
+	auto rom = RomImage::LoadFromFile("../../ROMs/gb-snake.gb");
+	ASSERT_TRUE(rom != nullptr && rom->GetHeader() != nullptr);
+
+	auto header = rom->GetHeader();
+	EXPECT_EQ("ROM", header->GetTitle());
+	EXPECT_TRUE(header->GetMapper() == CartridgeHeader::Mapper::RomOnly);
+	EXPECT_EQ(2, header->GetRomBanks());
+	EXPECT_EQ(0, header->GetRamBanks());
+	EXPECT_FALSE(header->HasBattery());
+	EXPECT_TRUE(header->IsHeaderChecksumValid());
+	EXPECT_TRUE(header->IsGlobalChecksumValid());
+
+	std::vector<unsigned char> bytes(rom->Data(), rom->Data() + rom->Size());
+	bytes[0x147] = 0x10;
+	bytes[0x149] = 0x03;
+
+	RomImage modified{ std::move(bytes) };
+	header = modified.GetHeader();
+	EXPECT_TRUE(header->GetMapper() == CartridgeHeader::Mapper::Mbc3);
+	EXPECT_EQ(4, header->GetRamBanks());
+	EXPECT_TRUE(header->HasBattery());
+	EXPECT_TRUE(header->HasRtc());
+	EXPECT_FALSE(header->IsHeaderChecksumValid());
+	EXPECT_FALSE(header->IsGlobalChecksumValid());
+
+	EXPECT_TRUE(std::make_shared<const RomImage>(std::vector<unsigned char>(0x100))->GetHeader() == nullptr);
+}
+
+TEST(CartridgeTests, RamBanksFromHeader)
+{
+	auto cartridge = CartridgeFactory::Create(MakeBankedRom(4, 0x03, 0x03));
+	ASSERT_TRUE(cartridge != nullptr);
+
+	cartridge->RomWriteByte(0x0000, 0x0a);
+	cartridge->RomWriteByte(0x6000, 0x01);
+
+	for (unsigned char bank = 0; bank < 4; bank++)
+	{
+		cartridge->RomWriteByte(0x4000, bank);
+		cartridge->RamWriteByte(0x0000, bank + 0x10);
+	}
+
+	for (unsigned char bank = 0; bank < 4; bank++)
+	{
+		cartridge->RomWriteByte(0x4000, bank);
+		EXPECT_EQ(bank + 0x10, cartridge->RamReadByte(0x0000));
+	}
+}
+
+TEST(CartridgeTests, SumBytes)
+{
+	std::vector<unsigned char> bytes(1000);
+	for (size_t i = 0; i < bytes.size(); i++) bytes[i] = static_cast<unsigned char>(i * 7 + 3);
+
+	// Covers partial vectors at the end and sums wrapping past 16 bits
+	for (size_t size : { 0, 1, 15, 16, 17, 999, 1000 })
+	{
+		unsigned short expected = 0;
+		for (size_t i = 0; i < size; i++) expected += bytes[i];
+
+		EXPECT_EQ(expected, CartridgeHeader::SumBytes(bytes.data(), size));
+	}
+
+	std::vector<unsigned char> large(0x10000, 0xff);
+	EXPECT_EQ(static_cast<unsigned short>(0x10000 * 0xff), CartridgeHeader::SumBytes(large.data(), large.size()));
+}
+
+TEST(CartridgeTests, BatteryRamSaveFile)
+{
+	const std::string romPath = "CartridgeTests-battery.gb";
+	const std::string savePath = CartridgeFactory::GetSavePath(romPath);
+	ASSERT_EQ("CartridgeTests-battery.sav", savePath);
+	std::remove(savePath.c_str());
+
+	// MBC1 with 32KB of battery-backed RAM
+	auto rom = MakeBankedRom(4, 0x03, 0x03);
+	{
+		std::ofstream ofs(romPath, std::ios::binary);
+		ofs.write(reinterpret_cast<const char*>(rom->Data()), rom->Size());
+	}
+
+	auto selectRamBank2 = [](Cartridge& cartridge)
+	{
+		cartridge.RomWriteByte(0x0000, 0x0a);
+		cartridge.RomWriteByte(0x6000, 0x01);
+		cartridge.RomWriteByte(0x4000, 0x02);
+	};
+
+	// Save files are only used when asked for
+	EXPECT_FALSE(CartridgeFactory::LoadFromFile(romPath)->IsRamPersistent());
+
+	{
+		auto cartridge = CartridgeFactory::LoadFromFile(romPath, savePath);
+		ASSERT_TRUE(cartridge != nullptr);
+		EXPECT_TRUE(cartridge->IsRamPersistent());
+
+		// Another session can't open the save file while it's in use, and keeps RAM of its own
+		auto otherCartridge = CartridgeFactory::LoadFromFile(romPath, savePath);
+		ASSERT_TRUE(otherCartridge != nullptr);
+		EXPECT_FALSE(otherCartridge->IsRamPersistent());
+
+		selectRamBank2(*cartridge);
+		selectRamBank2(*otherCartridge);
+		cartridge->RamWriteByte(0x1234, 0x42);
+		otherCartridge->RamWriteByte(0x1234, 0x24);
+
+		EXPECT_EQ(0x42, cartridge->RamReadByte(0x1234));
+		EXPECT_EQ(0x24, otherCartridge->RamReadByte(0x1234));
+	}
+
+	std::ifstream ifs(savePath, std::ios::binary);
+	std::vector<unsigned char> save{ std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
+	ASSERT_EQ(4u * 0x2000, save.size());
+	EXPECT_EQ(0x42, save[2 * 0x2000 + 0x1234]);
+
+	{
+		auto cartridge = CartridgeFactory::LoadFromFile(romPath, savePath);
+		ASSERT_TRUE(cartridge != nullptr);
+		EXPECT_TRUE(cartridge->IsRamPersistent());
+
+		selectRamBank2(*cartridge);
+		EXPECT_EQ(0x42, cartridge->RamReadByte(0x1234));
+	}
+
+	// RAM without a battery isn't saved
+	EXPECT_FALSE(CartridgeFactory::Create(MakeBankedRom(4, 0x02, 0x03))->IsRamPersistent());
+
+	ifs.close();
+	std::remove(romPath.c_str());
+	std::remove(savePath.c_str());
+}
+
+TEST(CartridgeTests, SaveFileFlushing)
+{
+	const std::string savePath = "CartridgeTests-flushing.sav";
+	const std::string otherSavePath = "CartridgeTests-flushing-other.sav";
+	std::remove(savePath.c_str());
+
+	{
+		auto ram = CartridgeRam::OpenSaveFile(savePath, 0x8000);
+		ASSERT_TRUE(ram != nullptr);
+		EXPECT_FALSE(ram->IsDirty());
+
+		ram->Data()[0x5000] = 0x12;
+		ram->MarkDirty(0x5000);
+		EXPECT_TRUE(ram->IsDirty());
+
+		ram->Flush();
+		EXPECT_FALSE(ram->IsDirty());
+
+		// Left alone, writes are flushed in the background
+		SaveFileFlusher::SetInterval(std::chrono::milliseconds(1));
+
+		ram->Data()[0x100] = 0x34;
+		ram->MarkDirty(0x100);
+
+		for (auto wait = 0; wait < 1000 && ram->IsDirty(); wait++) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		EXPECT_FALSE(ram->IsDirty());
+
+		// Save files can come and go while others are being flushed
+		for (auto i = 0; i < 20; i++)
+		{
+			auto other = CartridgeRam::OpenSaveFile(otherSavePath, 0x2000);
+			ASSERT_TRUE(other != nullptr);
+
+			other->Data()[i] = static_cast<unsigned char>(i + 1);
+			other->MarkDirty(i);
+			ram->MarkDirty(0x100);
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		SaveFileFlusher::SetInterval(SaveFileFlusher::DefaultInterval);
+	}
+
+	std::ifstream ifs(savePath, std::ios::binary);
+	std::vector<unsigned char> save{ std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
+	ASSERT_EQ(0x8000u, save.size());
+	EXPECT_EQ(0x12, save[0x5000]);
+	EXPECT_EQ(0x34, save[0x100]);
+
+	ifs.close();
+	std::remove(savePath.c_str());
+	std::remove(otherSavePath.c_str());
+}
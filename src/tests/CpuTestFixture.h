@@ -3,14 +3,19 @@
 #include "TestCpu.h"
 #include <gtest/gtest.h>
 
-class CpuTestFixture : public testing::Test
+// Parameterised on the dispatch engine so that every CPU test runs against each of them
+class CpuTestFixture : public testing::TestWithParam<CpuEngine>
 {
 public:
 	InputJoypad Joypad;
 	TestMemoryMap MemoryMap { Joypad };
-	TestCpu Cpu{ MemoryMap };
+	TestCpu<> Cpu{ MemoryMap };
 
-	CpuTestFixture() {}
+	CpuTestFixture()
+	{
+		MemoryMap.SetCpu(&Cpu);
+		Cpu.SetEngine(GetParam());
+	}
 	~CpuTestFixture();
 };
 
@@ -68,7 +68,9 @@ const std::vector<TestData16Reg2> Reg16TestCases2
 	{ [](Registers& r) -> auto& { return r.HL; }, 0x32, 0x3a }
 };
 
-TEST_F(CpuTestFixture, Nop)
+INSTANTIATE_TEST_CASE_P(Engines, CpuTestFixture, testing::Values(CpuEngine::JumpTable, CpuEngine::Threaded, CpuEngine::Recompiler));
+
+TEST_P(CpuTestFixture, Nop)
 {
 	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0, 0 });
 
@@ -81,7 +83,7 @@ TEST_F(CpuTestFixture, Nop)
 	EXPECT_EQ(oldReg, Cpu.Registers());
 }
 
-TEST_F(CpuTestFixture, Ld16RegImm)
+TEST_P(CpuTestFixture, Ld16RegImm)
 {
 	for (auto test : Reg16TestCases1)
 	{
@@ -104,7 +106,7 @@ TEST_F(CpuTestFixture, Ld16RegImm)
 	}
 }
 
-TEST_F(CpuTestFixture, St8MemAcc)
+TEST_P(CpuTestFixture, St8MemAcc)
 {
 	int address = MemoryMap::RamFixed;
 
@@ -138,7 +140,7 @@ TEST_F(CpuTestFixture, St8MemAcc)
 	}
 }
 
-TEST_F(CpuTestFixture, Ld8AccMem)
+TEST_P(CpuTestFixture, Ld8AccMem)
 {
 	int address = MemoryMap::RamFixed;
 
@@ -189,7 +191,59 @@ TEST_F(CpuTestFixture, Ld8AccMem)
 	}
 }
 
-TEST_F(CpuTestFixture, IncDec16Reg)
+TEST_P(CpuTestFixture, EchoRamAccess)
+{
+	/* Work RAM written through its echo and read back directly:
+	*
+	* 0x0000 0x3e 0x5a				LD A, 0x5a
+	* 0x0002 0xea 0x05 0xe0		LD (0xe005), A
+	* 0x0005 0xaf					XOR A
+	* 0x0006 0xfa 0x05 0xc0		LD A, (0xc005)
+	*/
+	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0x3e, 0x5a, 0xea, 0x05, 0xe0, 0xaf, 0xfa, 0x05, 0xc0 });
+	MemoryMap[0xc005] = 0;
+
+	EXPECT_EQ(TwoCycles + FourCycles + OneCycle + FourCycles, Cpu.RunCycles(TwoCycles + FourCycles + OneCycle + FourCycles));
+	EXPECT_EQ(0x5a, MemoryMap[0xc005]);
+	EXPECT_EQ(0x5a, Cpu.Registers().A);
+	EXPECT_EQ(0x5a, MemoryMap.ReadByte(0xe005));
+}
+
+TEST_P(CpuTestFixture, IoPorts)
+{
+	/* Interrupt flags, an unmapped register and a register mapped by the test:
+	*
+	* 0x0000 0x3e 0xff				LD A, 0xff
+	* 0x0002 0xe0 0x0f				LDH (0x0f), A
+	* 0x0004 0xf0 0x0f				LDH A, (0x0f)
+	* 0x0006 0x47					LD B, A
+	* 0x0007 0xf0 0x03				LDH A, (0x03)
+	* 0x0009 0x4f					LD C, A
+	* 0x000a 0x3e 0x42				LD A, 0x42
+	* 0x000c 0xe0 0x01				LDH (0x01), A
+	* 0x000e 0xf0 0x01				LDH A, (0x01)
+	*/
+	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0x3e, 0xff, 0xe0, 0x0f, 0xf0, 0x0f, 0x47, 0xf0, 0x03, 0x4f, 0x3e, 0x42, 0xe0, 0x01, 0xf0, 0x01 });
+
+	unsigned char serialData = 0;
+
+	MemoryMap.MapIoPort(0xff01, &serialData,
+		[](void* data, unsigned short address) { return static_cast<unsigned char>(*static_cast<unsigned char*>(data) + 1); },
+		[](void* data, unsigned short address, unsigned char value) { *static_cast<unsigned char*>(data) = value; });
+
+	Cpu.InterruptsEnabled() = false;
+	auto& reg = Cpu.Registers();
+
+	while (reg.PC < 0x10) Cpu.DoNextInstruction();
+
+	EXPECT_EQ(InterruptFlags::AllInt, Cpu.WaitingInterrupts());
+	EXPECT_EQ(0xff, reg.B);
+	EXPECT_EQ(0xff, reg.C);
+	EXPECT_EQ(0x42, serialData);
+	EXPECT_EQ(0x43, reg.A);
+}
+
+TEST_P(CpuTestFixture, IncDec16Reg)
 {
 	for (auto test : Reg16TestCases1)
 	{
@@ -237,7 +291,7 @@ TEST_F(CpuTestFixture, IncDec16Reg)
 	}
 }
 
-TEST_F(CpuTestFixture, IncDec8RegOrMem)
+TEST_P(CpuTestFixture, IncDec8RegOrMem)
 {
 	for (auto test : Reg8TestCases)
 	{
@@ -321,7 +375,7 @@ TEST_F(CpuTestFixture, IncDec8RegOrMem)
 	}
 }
 
-TEST_F(CpuTestFixture, Ld8RegOrMemImm)
+TEST_P(CpuTestFixture, Ld8RegOrMemImm)
 {
 	for (auto test : Reg8TestCases)
 	{
@@ -360,7 +414,7 @@ TEST_F(CpuTestFixture, Ld8RegOrMemImm)
 	}
 }
 
-TEST_F(CpuTestFixture, Rlca)
+TEST_P(CpuTestFixture, Rlca)
 {
 	const std::vector<std::vector<unsigned char>> tests =
 	{
@@ -392,7 +446,7 @@ TEST_F(CpuTestFixture, Rlca)
 	}
 }
 
-TEST_F(CpuTestFixture, Rla)
+TEST_P(CpuTestFixture, Rla)
 {
 	const std::vector<std::vector<unsigned char>> tests =
 	{
@@ -424,7 +478,7 @@ TEST_F(CpuTestFixture, Rla)
 	}
 }
 
-TEST_F(CpuTestFixture, Rrca)
+TEST_P(CpuTestFixture, Rrca)
 {
 	const std::vector<std::vector<unsigned char>> tests =
 	{
@@ -456,7 +510,7 @@ TEST_F(CpuTestFixture, Rrca)
 	}
 }
 
-TEST_F(CpuTestFixture, Rra)
+TEST_P(CpuTestFixture, Rra)
 {
 	const std::vector<std::vector<unsigned char>> tests =
 	{
@@ -488,7 +542,7 @@ TEST_F(CpuTestFixture, Rra)
 	}
 }
 
-TEST_F(CpuTestFixture, St16MemSp)
+TEST_P(CpuTestFixture, St16MemSp)
 {
 	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0x8, MemoryMap::RamFixed & 0xff, MemoryMap::RamFixed >> 8,
 										0x8, (MemoryMap::RamFixed & 0xff) + 4, MemoryMap::RamFixed >> 8 });
@@ -521,7 +575,7 @@ TEST_F(CpuTestFixture, St16MemSp)
 	EXPECT_EQ(0xaa, MemoryMap.ReadByte(MemoryMap:: RamFixed + 5));
 }
 
-TEST_F(CpuTestFixture, Add16RegHl)
+TEST_P(CpuTestFixture, Add16RegHl)
 {
 	for (auto test : Reg16TestCases1)
 	{
@@ -559,7 +613,7 @@ TEST_F(CpuTestFixture, Add16RegHl)
 	}
 }
 
-TEST_F(CpuTestFixture, Daa)
+TEST_P(CpuTestFixture, Daa)
 {
 	const std::vector<std::vector<unsigned char>> tests =
 	{
@@ -593,7 +647,7 @@ TEST_F(CpuTestFixture, Daa)
 	}
 }
 
-TEST_F(CpuTestFixture, Cpl)
+TEST_P(CpuTestFixture, Cpl)
 {
 	const std::vector<std::vector<unsigned char>> tests =
 	{
@@ -629,7 +683,7 @@ TEST_F(CpuTestFixture, Cpl)
 	}
 }
 
-TEST_F(CpuTestFixture, Scf)
+TEST_P(CpuTestFixture, Scf)
 {
 	const std::vector<std::vector<unsigned char>> tests =
 	{
@@ -661,7 +715,7 @@ TEST_F(CpuTestFixture, Scf)
 	}
 }
 
-TEST_F(CpuTestFixture, Ccf)
+TEST_P(CpuTestFixture, Ccf)
 {
 	const std::vector<std::vector<unsigned char>> tests =
 	{
@@ -693,7 +747,7 @@ TEST_F(CpuTestFixture, Ccf)
 	}
 }
 
-TEST_F(CpuTestFixture, Ld8RegOrMemRegOrMem)
+TEST_P(CpuTestFixture, Ld8RegOrMemRegOrMem)
 {
 	const std::vector<std::tuple<unsigned char, int, std::function<void(Registers&, unsigned char)>, std::function<unsigned char(Registers&)>>> tests =
 	{
@@ -739,7 +793,7 @@ TEST_F(CpuTestFixture, Ld8RegOrMemRegOrMem)
 	}
 }
 
-TEST_F(CpuTestFixture, AluOp8AccRegOrMem)
+TEST_P(CpuTestFixture, AluOp8AccRegOrMem)
 {
 	const std::vector<std::tuple<int, std::function<void(Registers&, unsigned char)>>> sources =
 	{
@@ -856,7 +910,7 @@ TEST_F(CpuTestFixture, AluOp8AccRegOrMem)
 	}
 }
 
-TEST_F(CpuTestFixture, AluOp8AccImm)
+TEST_P(CpuTestFixture, AluOp8AccImm)
 {
 	enum Operation : unsigned char
 	{
@@ -951,7 +1005,7 @@ TEST_F(CpuTestFixture, AluOp8AccImm)
 	}
 }
 
-TEST_F(CpuTestFixture, Ret)
+TEST_P(CpuTestFixture, Ret)
 {
 	const std::vector<std::tuple<unsigned char, unsigned char, bool, int>> tests =
 	{
@@ -1033,7 +1087,7 @@ TEST_F(CpuTestFixture, Ret)
 	}
 }
 
-TEST_F(CpuTestFixture, Pop)
+TEST_P(CpuTestFixture, Pop)
 {
 	const std::vector<std::tuple<unsigned char, unsigned short&(*)(Registers&), unsigned short>> scenarios
 	{
@@ -1073,7 +1127,7 @@ TEST_F(CpuTestFixture, Pop)
 	}
 }
 
-TEST_F(CpuTestFixture, Push)
+TEST_P(CpuTestFixture, Push)
 {
 	const std::vector<std::tuple<unsigned char, unsigned short&(*)(Registers&)>> scenarios
 	{
@@ -1117,7 +1171,7 @@ TEST_F(CpuTestFixture, Push)
 	}
 }
 
-TEST_F(CpuTestFixture, JpCall)
+TEST_P(CpuTestFixture, JpCall)
 {
 	const std::vector<std::tuple<unsigned char, unsigned char, bool, bool>> tests =
 	{
@@ -1230,7 +1284,7 @@ TEST_F(CpuTestFixture, JpCall)
 	}
 }
 
-TEST_F(CpuTestFixture, Rst)
+TEST_P(CpuTestFixture, Rst)
 {
 	std::vector<std::vector<unsigned char>> tests =
 	{
@@ -1276,7 +1330,7 @@ TEST_F(CpuTestFixture, Rst)
 }
 
 
-TEST_F(CpuTestFixture, CbPrefixOpcodes)
+TEST_P(CpuTestFixture, CbPrefixOpcodes)
 {
 	const std::vector<std::tuple<int, std::function<unsigned char(Registers&)>, std::function<void(Registers&, unsigned char)>>> sources =
 	{
@@ -1445,7 +1499,7 @@ TEST_F(CpuTestFixture, CbPrefixOpcodes)
 }
 
 
-TEST_F(CpuTestFixture, VBlankInterrupt)
+TEST_P(CpuTestFixture, VBlankInterrupt)
 {
 	/*
 	 * 0x0:					Start:
@@ -1543,7 +1597,7 @@ TEST_F(CpuTestFixture, VBlankInterrupt)
 }
 
 
-TEST_F(CpuTestFixture, VBlankInterruptDisabled)
+TEST_P(CpuTestFixture, VBlankInterruptDisabled)
 {
 	/*
 	* 0x0:					Start:
@@ -1597,3 +1651,336 @@ TEST_F(CpuTestFixture, VBlankInterruptDisabled)
 
 
 
+
+TEST_P(CpuTestFixture, SelfModifyingCode)
+{
+	/* Code run from RAM that overwrites the operand of its own first instruction:
+	*
+	* 0xc000 0x3e 0x11				LD A, 0x11
+	* 0xc002 0x21 0x01 0xc0		LD HL, 0xc001
+	* 0xc005 0x36 0x22				LD (HL), 0x22
+	* 0xc007 0xc3 0x00 0xc0		JP 0xc000
+	*/
+	MemoryMap.SetBytes(MemoryMap::RamFixed, { 0x3e, 0x11, 0x21, 0x01, 0xc0, 0x36, 0x22, 0xc3, 0x00, 0xc0 });
+
+	auto& reg = Cpu.Registers();
+	reg.PC = MemoryMap::RamFixed;
+
+	for (auto i = 0; i < 4; i++) Cpu.DoNextInstruction();
+
+	EXPECT_EQ(0x11, reg.A);
+	EXPECT_EQ(0x22, MemoryMap.ReadByte(MemoryMap::RamFixed + 1));
+
+	Cpu.DoNextInstruction();
+
+	EXPECT_EQ(0x22, reg.A);
+	EXPECT_EQ(MemoryMap::RamFixed + 2, reg.PC);
+}
+
+TEST_P(CpuTestFixture, RunCyclesHotLoop)
+{
+	/* A loop run often enough to be compiled by the recompiler:
+	*
+	* 0x0000 0x0e 0x00				LD C, 0
+	* 0x0002 0x0c					INC C
+	* 0x0003 0x41					LD B, C
+	* 0x0004 0x3e 0x07				LD A, 7
+	* 0x0006 0xc3 0x02 0x00		JP 0x0002
+	*/
+	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0x0e, 0x00, 0x0c, 0x41, 0x3e, 0x07, 0xc3, 0x02, 0x00 });
+
+	const auto loopCycles = OneCycle + OneCycle + TwoCycles + FourCycles;
+	auto& reg = Cpu.Registers();
+
+	// Stop partway through an iteration
+	EXPECT_EQ(TwoCycles + loopCycles * 50 + OneCycle, Cpu.RunCycles(TwoCycles + loopCycles * 50 + OneCycle));
+	EXPECT_EQ(51, reg.C);
+	EXPECT_EQ(50, reg.B);
+	EXPECT_EQ(0x3, reg.PC);
+
+	EXPECT_EQ(loopCycles * 50 - OneCycle, Cpu.RunCycles(loopCycles * 50 - OneCycle));
+	EXPECT_EQ(100, reg.C);
+	EXPECT_EQ(100, reg.B);
+	EXPECT_EQ(7, reg.A);
+	EXPECT_EQ(0x2, reg.PC);
+	EXPECT_EQ(TwoCycles + loopCycles * 100, Cpu.GetTotalCycles());
+}
+
+TEST_P(CpuTestFixture, RecompileInvalidOpcodes)
+{
+	/* Two equally hot blocks, the second ending in an invalid opcode:
+	*
+	* 0x0000 0x04					INC B
+	* 0x0001 0x04					INC B
+	* 0x0002 0x18 0xfc				JR 0x0000
+	* 0x0004 0x04					INC B
+	* 0x0005 0x04					INC B
+	* 0x0006 0xd3					(invalid)
+	*/
+	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0x04, 0x04, 0x18, 0xfc, 0x04, 0x04, 0xd3 });
+
+	auto loopBlock = Cpu.BlockCache().GetBlock(0x0);
+	auto invalidBlock = Cpu.BlockCache().GetBlock(0x4);
+	ASSERT_TRUE(loopBlock != nullptr && invalidBlock != nullptr);
+
+	// The invalid opcode's exception couldn't unwind through compiled code, so that block is never compiled
+	Recompiler::NativeBlock loopCode = nullptr;
+	Recompiler::NativeBlock invalidCode = nullptr;
+
+	for (auto i = 0; i < 100; i++)
+	{
+		loopCode = Cpu.Recompiler().GetNativeCode(*loopBlock);
+		invalidCode = Cpu.Recompiler().GetNativeCode(*invalidBlock);
+	}
+
+	EXPECT_EQ(Recompiler::IsSupported(), loopCode != nullptr);
+	EXPECT_TRUE(invalidCode == nullptr);
+}
+
+TEST_P(CpuTestFixture, RunCyclesFusedLoop)
+{
+	/* A counted loop whose body is run by a single fused handler (DEC BC / LD A,B / OR C / JR NZ):
+	*
+	* 0x0000 0x01 0x00 0x01		LD BC, 0x100
+	* 0x0003 0x0b					DEC BC
+	* 0x0004 0x78					LD A, B
+	* 0x0005 0xb1					OR C
+	* 0x0006 0x20 0xfb				JR NZ, 0x0003
+	* 0x0008 0x3c					INC A
+	*/
+	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0x01, 0x00, 0x01, 0x0b, 0x78, 0xb1, 0x20, 0xfb, 0x3c });
+
+	const auto loopCycles = TwoCycles + OneCycle + OneCycle + ThreeCycles;
+	auto& reg = Cpu.Registers();
+
+	auto block = Cpu.BlockCache().GetBlock(0x3);
+	ASSERT_TRUE(block != nullptr);
+	ASSERT_EQ(4u, block->Instructions.size());
+	EXPECT_EQ(0x10b, block->Instructions[0].Handler);
+
+	// Stop partway through the fused sequence
+	EXPECT_EQ(ThreeCycles + TwoCycles, Cpu.RunCycles(ThreeCycles + TwoCycles));
+	EXPECT_EQ(0xff, reg.C);
+	EXPECT_EQ(0x0, reg.B);
+	EXPECT_EQ(0x4, reg.PC);
+
+	EXPECT_EQ(OneCycle * 2, Cpu.RunCycles(OneCycle * 2));
+	EXPECT_EQ(0xff, reg.A);
+	EXPECT_EQ(0x6, reg.PC);
+
+	EXPECT_EQ(ThreeCycles + loopCycles * 0xfe, Cpu.RunCycles(ThreeCycles + loopCycles * 0xfe));
+	EXPECT_EQ(0x1, reg.C);
+	EXPECT_EQ(0x3, reg.PC);
+
+	// Final iteration falls through
+	EXPECT_EQ(TwoCycles + OneCycle + OneCycle + TwoCycles + OneCycle, Cpu.RunCycles(TwoCycles + OneCycle + OneCycle + TwoCycles + OneCycle));
+	EXPECT_EQ(0x0, reg.C);
+	EXPECT_EQ(0x1, reg.A);
+	EXPECT_EQ(0x9, reg.PC);
+	EXPECT_EQ(ThreeCycles + loopCycles * 0xff + TwoCycles + OneCycle * 3 + TwoCycles, Cpu.GetTotalCycles());
+}
+
+TEST_P(CpuTestFixture, FusedCopyLoop)
+{
+	/* A block copy whose fusable sequences overlap (LD (DE),A starts one and ends another, as does LD A,B):
+	*
+	* 0x0000 0x21 0x20 0x00		LD HL, 0x0020
+	* 0x0003 0x11 0x00 0xc0		LD DE, 0xc000
+	* 0x0006 0x01 0x04 0x00		LD BC, 0x0004
+	* 0x0009 0x2a					LD A, (HL+)
+	* 0x000a 0x12					LD (DE), A
+	* 0x000b 0x13					INC DE
+	* 0x000c 0x0b					DEC BC
+	* 0x000d 0x78					LD A, B
+	* 0x000e 0xb1					OR C
+	* 0x000f 0x20 0xf8				JR NZ, 0x0009
+	*/
+	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0x21, 0x20, 0x00, 0x11, 0x00, 0xc0, 0x01, 0x04, 0x00, 0x2a, 0x12, 0x13, 0x0b, 0x78, 0xb1, 0x20, 0xf8 });
+	MemoryMap.SetBytes(0x20, { 0x12, 0x34, 0x56, 0x78 });
+
+	// The whole loop body is covered by two fused handlers
+	auto block = Cpu.BlockCache().GetBlock(0x9);
+	ASSERT_TRUE(block != nullptr);
+	ASSERT_EQ(7u, block->Instructions.size());
+
+	const std::vector<unsigned short> handlers{ 0x10c, 0x12, 0x13, 0x10b, 0x78, 0xb1, 0x20 };
+	for (size_t i = 0; i < handlers.size(); i++)
+	{
+		EXPECT_EQ(handlers[i], block->Instructions[i].Handler) << "instruction " << i;
+	}
+
+	const auto iterationCycles = TwoCycles * 4 + OneCycle * 2 + ThreeCycles;
+	const auto totalCycles = ThreeCycles * 3 + iterationCycles * 4 - OneCycle;
+	EXPECT_EQ(totalCycles, Cpu.RunCycles(totalCycles));
+
+	auto& reg = Cpu.Registers();
+	EXPECT_EQ(0x11, reg.PC);
+	EXPECT_EQ(0x24, reg.HL);
+	EXPECT_EQ(0xc004, reg.DE);
+	EXPECT_EQ(0x0, reg.BC);
+
+	for (unsigned short i = 0; i < 4; i++)
+	{
+		EXPECT_EQ(MemoryMap.ReadByte(0x20 + i), MemoryMap.ReadByte(MemoryMap::RamFixed + i));
+	}
+}
+
+TEST_P(CpuTestFixture, FlagsAcrossInstructions)
+{
+	/* Flags set by one instruction and partly preserved by the next, then read within the same run:
+	*
+	* 0x0000 0x88					ADC A, B
+	* 0x0001 0x0d					DEC C
+	* 0x0002 0xf5					PUSH AF
+	*/
+	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0x88, 0x0d, 0xf5 });
+
+	const unsigned short stackStart = MemoryMap::RamFixed + 2;
+
+	const std::vector<std::tuple<unsigned char, unsigned char, unsigned char, unsigned char>> tests
+	{
+		// A		B		C		Expected F
+		{ 0x00,		0x00,	0x01,	ZeroFlag | SubFlag },
+		{ 0x0f,		0x00,	0x10,	SubFlag | HalfCarryFlag },
+		{ 0xff,		0x00,	0x00,	CarryFlag | SubFlag | HalfCarryFlag },
+		{ 0xf0,		0x10,	0x02,	CarryFlag | SubFlag },
+		{ 0x7f,		0x80,	0x01,	CarryFlag | ZeroFlag | SubFlag },
+	};
+
+	for (auto& test : tests)
+	{
+		auto& reg = Cpu.Registers();
+
+		reg.PC = 0;
+		reg.SP = stackStart;
+		reg.A = std::get<0>(test);
+		reg.B = std::get<1>(test);
+		reg.C = std::get<2>(test);
+		reg.F = CarryFlag;
+
+		EXPECT_EQ(OneCycle * 2 + FourCycles, Cpu.RunCycles(OneCycle * 2 + FourCycles));
+
+		EXPECT_EQ(std::get<3>(test), MemoryMap.ReadByte(stackStart - 2));
+		EXPECT_EQ(std::get<3>(test), reg.F);
+	}
+}
+
+TEST_P(CpuTestFixture, HaltedRunCycles)
+{
+	// HALT
+	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0x76, 0x00 });
+
+	Cpu.InterruptsEnabled() = true;
+	EXPECT_EQ(OneCycle, Cpu.DoNextInstruction());
+	EXPECT_FALSE(Cpu.IsClockRunning());
+
+	// Halted CPU idles through whole budgets in machine cycles, without counting them in total cycles
+	EXPECT_EQ(OneCycle * 1000, Cpu.RunCycles(OneCycle * 1000));
+	EXPECT_EQ(OneCycle * 1001, Cpu.RunCycles(OneCycle * 1000 + 1));
+	EXPECT_EQ(OneCycle, Cpu.GetTotalCycles());
+	EXPECT_EQ(0x1, Cpu.Registers().PC);
+
+	Cpu.EnabledInterrupts() = InterruptFlags::VBlankInt;
+	Cpu.RequestInterrupt(InterruptFlags::VBlankInt);
+	EXPECT_TRUE(Cpu.IsClockRunning());
+}
+
+TEST_P(CpuTestFixture, RunCyclesPollingLoop)
+{
+	/* Loop spinning until a flag in RAM is set:
+	*
+	* 0x0000 0xfa 0x00 0xc0		LD A, (0xc000)
+	* 0x0003 0xfe 0x01				CP 1
+	* 0x0005 0x20 0xf9				JR NZ, -7
+	* 0x0007 0x00					NOP
+	*/
+	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0xfa, 0x00, 0xc0, 0xfe, 0x01, 0x20, 0xf9, 0x00 });
+	MemoryMap.SetBytes(MemoryMap::RamFixed, { 0x00 });
+
+	const auto loopCycles = FourCycles + TwoCycles + ThreeCycles;
+	auto& reg = Cpu.Registers();
+
+	// Stops at the first instruction to reach the budget, as if every iteration was run
+	EXPECT_EQ(loopCycles * 1000 + FourCycles + TwoCycles, Cpu.RunCycles(loopCycles * 1000 + FourCycles + 1));
+	EXPECT_EQ(0x5, reg.PC);
+	EXPECT_EQ(loopCycles * 1000 + FourCycles + TwoCycles, Cpu.GetTotalCycles());
+
+	EXPECT_EQ(ThreeCycles + loopCycles * 10, Cpu.RunCycles(ThreeCycles + loopCycles * 10));
+	EXPECT_EQ(0x0, reg.PC);
+
+	MemoryMap.SetBytes(MemoryMap::RamFixed, { 0x01 });
+
+	EXPECT_EQ(loopCycles - OneCycle, Cpu.RunCycles(loopCycles - OneCycle));
+	EXPECT_EQ(0x7, reg.PC);
+}
+
+TEST_P(CpuTestFixture, Watchpoints)
+{
+	/* Accesses to watched and unwatched RAM:
+	*
+	* 0x0000 0x3e 0x5a				LD A, 0x5a
+	* 0x0002 0xea 0x05 0xc0		LD (0xc005), A
+	* 0x0005 0xea 0x06 0xc0		LD (0xc006), A
+	* 0x0008 0xfa 0x05 0xe0		LD A, (0xe005)
+	* 0x000b 0xe0 0x90				LDH (0x90), A
+	* 0x000d 0xf0 0x90				LDH A, (0x90)
+	* 0x000f 0xea 0x05 0xe0		LD (0xe005), A
+	*/
+	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0x3e, 0x5a, 0xea, 0x05, 0xc0, 0xea, 0x06, 0xc0, 0xfa, 0x05, 0xe0, 0xe0, 0x90, 0xf0, 0x90, 0xea, 0x05, 0xe0 });
+
+	EXPECT_TRUE(MemoryMap.AddWatchpoint(0xc005, WatchAccess::Write));
+	EXPECT_TRUE(MemoryMap.AddWatchpoint(0xff90, WatchAccess::Read));
+	EXPECT_FALSE(MemoryMap.AddWatchpoint(0x4000, WatchAccess::Write));
+	EXPECT_FALSE(MemoryMap.AddWatchpoint(0xff0f, WatchAccess::Read));
+
+	std::vector<WatchpointHit> hits;
+	Cpu.SetWatchpointHandler([&hits](const WatchpointHit& hit) { hits.push_back(hit); });
+
+	const auto programCycles = TwoCycles + FourCycles * 4 + ThreeCycles * 2;
+	EXPECT_EQ(programCycles, Cpu.RunCycles(programCycles));
+
+	ASSERT_EQ(3u, hits.size());
+
+	EXPECT_EQ(0xc005, hits[0].Address);
+	EXPECT_EQ(0x5a, hits[0].Value);
+	EXPECT_TRUE(hits[0].Access == WatchAccess::Write);
+	EXPECT_EQ(0x0005, hits[0].PC);
+	EXPECT_EQ(static_cast<uint64_t>(TwoCycles), hits[0].Cycle);
+
+	EXPECT_EQ(0xff90, hits[1].Address);
+	EXPECT_TRUE(hits[1].Access == WatchAccess::Read);
+	EXPECT_EQ(0x000f, hits[1].PC);
+	EXPECT_EQ(static_cast<uint64_t>(TwoCycles + FourCycles * 3 + ThreeCycles), hits[1].Cycle);
+
+	// Watches on work RAM cover its echo
+	EXPECT_EQ(0xe005, hits[2].Address);
+	EXPECT_TRUE(hits[2].Access == WatchAccess::Write);
+
+	EXPECT_EQ(0x5a, MemoryMap[0xc005]);
+	EXPECT_EQ(0x5a, MemoryMap[0xc006]);
+	EXPECT_EQ(0x5a, MemoryMap.PeekByte(0xff90));
+
+	MemoryMap.ClearWatchpoints();
+	hits.clear();
+
+	Cpu.Registers().PC = 0;
+	EXPECT_EQ(programCycles, Cpu.RunCycles(programCycles));
+	EXPECT_TRUE(hits.empty());
+
+	/* Polling loop, which is otherwise skipped through once it's seen to be idle:
+	*
+	* 0x0000 0xfa 0x00 0xc0		LD A, (0xc000)
+	* 0x0003 0xa7					AND A
+	* 0x0004 0x28 0xfa				JR Z, -6
+	*/
+	MemoryMap.SetBytes(MemoryMap::RomFixed, { 0xfa, 0x00, 0xc0, 0xa7, 0x28, 0xfa });
+	MemoryMap[0xc000] = 0;
+	EXPECT_TRUE(MemoryMap.AddWatchpoint(0xc000, WatchAccess::Read));
+
+	const auto iterations = 100;
+	const auto iterationCycles = FourCycles + OneCycle + ThreeCycles;
+
+	Cpu.Registers().PC = 0;
+	EXPECT_EQ(iterationCycles * iterations, Cpu.RunCycles(iterationCycles * iterations));
+	EXPECT_EQ(static_cast<size_t>(iterations), hits.size());
+}
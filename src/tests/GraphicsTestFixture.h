@@ -12,11 +12,11 @@ class GraphicsTestFixture : public testing::Test
 public:
 	InputJoypad Joypad;
 	TestMemoryMap MemoryMap { Joypad };
-	TestCpu Cpu{ MemoryMap };
+	TestCpu<::MemoryMap> Cpu{ MemoryMap };
 	SpriteManager SpriteManager{};
 	Graphics Graphics{ Cpu, MemoryMap, SpriteManager };
 
-	GraphicsTestFixture() {}
+	GraphicsTestFixture() { MemoryMap.SetCpu(&Cpu); }
 	~GraphicsTestFixture();
 };
 
@@ -3,16 +3,8 @@
 #include <gtest/gtest.h>
 #include "GraphicsTestFixture.h"
 #include "../core/CartridgeFactory.h"
-
-void RunCpu(Cpu& cpu, int& currentCycle, int cycleTarget)
-{
-	while (currentCycle < cycleTarget && cpu.IsClockRunning())
-	{
-		currentCycle += cpu.DoNextInstruction();
-	}
-
-	currentCycle = std::max(currentCycle, cycleTarget);
-}
+#include <algorithm>
+#include <random>
 
 TEST_F(GraphicsTestFixture, RunInternalRom)
 {
@@ -23,45 +15,398 @@ TEST_F(GraphicsTestFixture, RunInternalRom)
 
 	MemoryMap.SetInternalRomEnabled(true);
 
-	auto cartridge = CartridgeFactory::LoadFromFile("../../ROMs/gb-snake.gb", 0);
+	auto cartridge = CartridgeFactory::LoadFromFile("../../ROMs/gb-snake.gb");
 	MemoryMap.SetCartridge(cartridge);
 
-	auto frameCounter = 0;
-
 	// Keep going until we're beyond the start of cartridge ROM
 	while (reg.PC < 0x100)
+	{
+		Graphics.RunFrame([this](int& currentCycle, int cycleTarget) { Cpu.RunUntil(currentCycle, cycleTarget); });
+	}
+}
+
+TEST_F(GraphicsTestFixture, VramLockout)
+{
+	const unsigned short address = MemoryMap::RamVideo + 0x10;
+
+	// Display on
+	MemoryMap.WriteByte(0xff40, 0x80);
+
+	Graphics.SetLcdcStatus(LcdcStatus::HBlankMode);
+	MemoryMap.WriteByte(address, 0x12);
+	EXPECT_EQ(0x12, MemoryMap.ReadByte(address));
+
+	// Writes while VRAM is being drawn from are lost
+	Graphics.SetLcdcStatus(LcdcStatus::OamAndVramReadMode);
+	MemoryMap.WriteByte(address, 0x34);
+
+	Graphics.SetLcdcStatus(LcdcStatus::HBlankMode);
+	EXPECT_EQ(0x12, MemoryMap.ReadByte(address));
+
+	MemoryMap.WriteByte(address, 0x56);
+	EXPECT_EQ(0x56, MemoryMap.ReadByte(address));
+}
+
+TEST_F(GraphicsTestFixture, DirtyTracking)
+{
+	EXPECT_TRUE(Graphics.GetDirtyTiles().all());
+	EXPECT_TRUE(Graphics.GetDirtyTileMapRows().all());
+	EXPECT_TRUE(Graphics.GetDirtySprites().all());
+
+	Graphics.ClearDirtyTiles();
+	Graphics.ClearDirtyTileMapRows();
+	Graphics.ClearDirtySprites();
+
+	// Second tile, third row of the second tile map and second sprite
+	MemoryMap.WriteByte(0x801f, 0x12);
+	MemoryMap.WriteByte(0x9c5f, 0x34);
+	MemoryMap.WriteByte(0xfe05, 0x56);
+
+	EXPECT_EQ(1u, Graphics.GetDirtyTiles().count());
+	EXPECT_TRUE(Graphics.GetDirtyTiles().test(1));
+	EXPECT_EQ(1u, Graphics.GetDirtyTileMapRows().count());
+	EXPECT_TRUE(Graphics.GetDirtyTileMapRows().test(Graphics::TileMapRows + 2));
+	EXPECT_EQ(1u, Graphics.GetDirtySprites().count());
+	EXPECT_TRUE(Graphics.GetDirtySprites().test(1));
+
+	EXPECT_EQ(0x12, MemoryMap.ReadByte(0x801f));
+	EXPECT_EQ(0x34, MemoryMap.ReadByte(0x9c5f));
+
+	// Writes lost to VRAM lockout don't mark anything
+	MemoryMap.WriteByte(0xff40, 0x80);
+	Graphics.SetLcdcStatus(LcdcStatus::OamAndVramReadMode);
+	Graphics.ClearDirtyTiles();
+	MemoryMap.WriteByte(0x8000, 0x78);
+	EXPECT_TRUE(Graphics.GetDirtyTiles().none());
+}
+
+TEST_F(GraphicsTestFixture, TileCache)
+{
+	auto shade = [](int colour) { return static_cast<int>(0xc0000000 | (3 - colour) * 0x40504a); };
+
+	// Display and background on with the first tile data table, identity palette, tile 1 at the top left
+	MemoryMap.WriteByte(0xff40, 0x91);
+	MemoryMap.WriteByte(0xff47, 0xe4);
+	MemoryMap.WriteByte(0x9800, 0x01);
+
+	// Tile 1, first row: colour 1 at the left edge, colour 2 at the right
+	MemoryMap.WriteByte(0x8010, 0x80);
+	MemoryMap.WriteByte(0x8011, 0x01);
+
+	Graphics.ResetFrame();
+	Graphics.RenderLine();
+
+	auto& tiles = Graphics.GetTileCache();
+	EXPECT_EQ(1, tiles.GetRow(1, 0)[0]);
+	EXPECT_EQ(2, tiles.GetRow(1, 0)[7]);
+	EXPECT_EQ(2, tiles.GetRow(1, 0, true)[0]);
+	EXPECT_EQ(1, tiles.GetRow(1, 0, true)[7]);
+
+	EXPECT_EQ(shade(1), Graphics.Bitmap[0]);
+	EXPECT_EQ(shade(0), Graphics.Bitmap[1]);
+	EXPECT_EQ(shade(2), Graphics.Bitmap[7]);
+
+	// Rewriting the tile is picked up on the next line drawn
+	MemoryMap.WriteByte(0x8010, 0xff);
+	MemoryMap.WriteByte(0x8011, 0xff);
+
+	Graphics.ResetFrame();
+	Graphics.RenderLine();
+
+	EXPECT_EQ(3, tiles.GetRow(1, 0)[0]);
+	EXPECT_EQ(shade(3), Graphics.Bitmap[0]);
+	EXPECT_EQ(shade(3), Graphics.Bitmap[7]);
+	EXPECT_EQ(shade(0), Graphics.Bitmap[8]);
+}
+
+TEST_F(GraphicsTestFixture, Palettes)
+{
+	const ::Graphics::OutputPalette outputPalette{ 10, 11, 12, 13 };
+	Graphics.SetOutputPalette(outputPalette);
+
+	// Background on with colours 0-3 in the first four pixels of tile 0, and an 8x8 sprite of colour 3 from pixel 4
+	MemoryMap.WriteByte(0xff40, 0x93);
+	MemoryMap.WriteByte(0x9800, 0x00);
+	MemoryMap.WriteByte(0x8000, 0x50);
+	MemoryMap.WriteByte(0x8001, 0x30);
+	MemoryMap.WriteByte(0x8010, 0xff);
+	MemoryMap.WriteByte(0x8011, 0xff);
+	MemoryMap.WriteByte(0xfe00, SpriteManager::SpriteYOffset);
+	MemoryMap.WriteByte(0xfe01, 4 + SpriteManager::SpriteXOffset);
+	MemoryMap.WriteByte(0xfe02, 1);
+
+	auto renderFirstLine = [&]()
 	{
 		Graphics.ResetFrame();
-		auto cycleCounter = 0;
-		auto cycleTarget = 0;
+		Graphics.RenderLine();
+		return std::vector<int>(Graphics.Bitmap, Graphics.Bitmap + 5);
+	};
+
+	MemoryMap.WriteByte(0xff47, 0xe4);
+	MemoryMap.WriteByte(0xff48, 0x00);
+	EXPECT_EQ(std::vector<int>({ 10, 11, 12, 13, 10 }), renderFirstLine());
+
+	// Palette writes apply from the next line drawn, to their own layer only
+	MemoryMap.WriteByte(0xff47, 0x1b);
+	MemoryMap.WriteByte(0xff48, 0x80);
+	MemoryMap.WriteByte(0xff49, 0xc0);
+	EXPECT_EQ(std::vector<int>({ 13, 12, 11, 10, 12 }), renderFirstLine());
+
+	MemoryMap.WriteByte(0xfe03, SpriteFlags::PaletteSelector);
+	EXPECT_EQ(std::vector<int>({ 13, 12, 11, 10, 13 }), renderFirstLine());
 
-		for (auto i = 0; i < Graphics::VertPixels; i++)
+	Graphics.SetOutputPalette(::Graphics::GetDefaultOutputPalette(FrameFormat::Rgba8888));
+	EXPECT_EQ(::Graphics::GetDefaultOutputPalette(FrameFormat::Rgba8888)[3], renderFirstLine()[0]);
+}
+
+TEST_F(GraphicsTestFixture, FrameFormats)
+{
+	// Two lines: the first with colours 0-3 repeating across the screen, the second blank with the display off
+	auto renderLines = [&](::Graphics& graphics)
+	{
+		MemoryMap.WriteByte(0xff40, 0x91);
+		MemoryMap.WriteByte(0xff47, 0xe4);
+		for (auto column = 0; column < 32; column++) MemoryMap.WriteByte(0x9800 + column, 0x00);
+		MemoryMap.WriteByte(0x8000, 0x55);
+		MemoryMap.WriteByte(0x8001, 0x33);
+
+		graphics.ResetFrame();
+		graphics.RenderLine();
+		MemoryMap.WriteByte(0xff40, 0x11);
+		graphics.RenderLine();
+	};
+
+	auto rgba = ::Graphics::GetDefaultOutputPalette(FrameFormat::Rgba8888);
+
+	for (auto format : { FrameFormat::Rgba8888, FrameFormat::Rgb565, FrameFormat::Grey8, FrameFormat::Indexed2 })
+	{
+		::Graphics graphics{ Cpu, MemoryMap, SpriteManager, format };
+		renderLines(graphics);
+
+		auto palette = ::Graphics::GetDefaultOutputPalette(format);
+		auto frame = reinterpret_cast<const unsigned char*>(graphics.Bitmap);
+		auto lineSize = graphics.GetFrameSize() / ::Graphics::VertPixels;
+
+		for (auto x = 0; x < static_cast<int>(::Graphics::HozPixels); x++)
 		{
-			Graphics.SetLcdcStatus(LcdcStatus::OamReadMode);
-			cycleTarget += Graphics::OamReadClocks;
-			RunCpu(Cpu, cycleCounter, cycleTarget);
+			auto shade = x % 4;
+			int pixel;
 
-			Graphics.SetLcdcStatus(LcdcStatus::OamAndVramReadMode);
-			cycleTarget += Graphics::OamAndVramReadClocks;
-			RunCpu(Cpu, cycleCounter, cycleTarget);
+			switch (format)
+			{
+			case FrameFormat::Rgba8888: pixel = reinterpret_cast<const int*>(frame)[x]; break;
+			case FrameFormat::Rgb565: pixel = reinterpret_cast<const uint16_t*>(frame)[x]; break;
+			case FrameFormat::Grey8: pixel = frame[x]; break;
+			default: pixel = frame[x / 4] >> (6 - shade * 2) & 0x3; break;
+			}
 
-			Graphics.SetLcdcStatus(LcdcStatus::HBlankMode);
-			cycleTarget += Graphics::HBlankPeriodClocks;
-			RunCpu(Cpu, cycleCounter, cycleTarget);
+			ASSERT_EQ(palette[shade], pixel) << "format " << static_cast<int>(format) << " x " << x;
+		}
 
-			Graphics.RenderLine();
+		EXPECT_EQ(lineSize, static_cast<unsigned int>(std::count(frame + lineSize, frame + lineSize * 2, format == FrameFormat::Indexed2 ? 0x00 : 0xff)));
+	}
+
+	EXPECT_EQ(92160u, ::Graphics::GetFrameSize(FrameFormat::Rgba8888));
+	EXPECT_EQ(5760u, ::Graphics::GetFrameSize(FrameFormat::Indexed2));
+
+	// Green-tinged RGB565, with the RGBA colour's red in the top bits
+	auto rgb565 = ::Graphics::GetDefaultOutputPalette(FrameFormat::Rgb565);
+	EXPECT_EQ((rgba[0] & 0xf8) << 8, rgb565[0] & 0xf800);
+	EXPECT_EQ((rgba[0] >> 16 & 0xf8) >> 3, rgb565[0] & 0x1f);
+	EXPECT_EQ(0, rgb565[3]);
+}
+
+TEST_F(GraphicsTestFixture, LineCompositing)
+{
+	std::mt19937 random(1234);
+	auto randomByte = [&]() { return static_cast<unsigned char>(random()); };
+
+	auto readByte = [&](unsigned short address) { return MemoryMap.ReadByte(address); };
+
+	auto tileColour = [&](int tileAddress, int x, int y)
+	{
+		auto baseByte = 0x8000 + tileAddress + ((y & 0x7) << 1);
+		auto bitShift = 7 - (x & 0x7);
+		return readByte(baseByte) >> bitShift & 0x1 | (readByte(baseByte + 1) >> bitShift & 0x1) << 1;
+	};
+
+	auto shade = [&](int colour, unsigned short paletteRegister)
+	{
+		return static_cast<int>(0xc0000000 | (3 - (readByte(paletteRegister) >> (colour << 1) & 0x3)) * 0x40504a);
+	};
+
+	for (auto scene = 0; scene < 8; scene++)
+	{
+		// Random tiles and maps, sprites crowded into a small area so that they overlap and exceed the line limit
+		for (auto address = 0x8000; address < 0xa000; address++) MemoryMap.WriteByte(address, randomByte());
+
+		for (auto sprite = 0; sprite < Graphics::SpriteCount; sprite++)
+		{
+			MemoryMap.WriteByte(0xfe00 + sprite * 4, 16 + random() % 48);
+			MemoryMap.WriteByte(0xfe00 + sprite * 4 + 1, random() % 64 + (sprite % 2 ? 0 : 104));
+			MemoryMap.WriteByte(0xfe00 + sprite * 4 + 2, randomByte());
+			MemoryMap.WriteByte(0xfe00 + sprite * 4 + 3, randomByte() & 0xf0);
 		}
 
-		frameCounter++;
+		for (auto address = 0xff42; address <= 0xff4b; address++)
+		{
+			if (address != 0xff44 && address != 0xff46) MemoryMap.WriteByte(address, randomByte());
+		}
 
-		Graphics.SetLcdcStatus(LcdcStatus::VBlankMode);
+		MemoryMap.WriteByte(0xff4a, random() % 64);
+		MemoryMap.WriteByte(0xff4b, random() % 168);
+		MemoryMap.WriteByte(0xff40, randomByte() | 0x80);
 
-		for (auto i = 0; i < Graphics::VBlankLines; i++)
+		auto lcdc = readByte(0xff40);
+		auto tallSprites = (lcdc & 0x4) != 0;
+		auto spriteHeight = tallSprites ? 16 : 8;
+		auto windowLine = 0;
+
+		// Sprites are picked for the first line when it's drawn, so pick them up front to compare against
+		Graphics.ResetFrame();
+		SpriteManager.SetScanline(0);
+
+		for (auto y = 0; y < Graphics::VertPixels; y++)
 		{
-			cycleTarget += Graphics::ScanlineClocks;
-			RunCpu(Cpu, cycleCounter, cycleTarget);
+			// Per-pixel renderer the compositor replaced
+			auto bgOrWinColour = [&](int x, int tileY, bool window)
+			{
+				auto tileMapBase = lcdc & (window ? 0x40 : 0x8) ? 0x1c00 : 0x1800;
+				unsigned char tileNumber = readByte(0x8000 + tileMapBase + ((tileY & 0xf8) << 2) + ((x & 0xff) >> 3));
+				return lcdc & 0x10 ? tileColour(tileNumber * 16, x, tileY) : tileColour(0x800 + static_cast<unsigned char>(tileNumber + 128) * 16, x, tileY);
+			};
+
+			auto& visibleSprites = SpriteManager.GetVisibleSprites();
+			std::vector<const SpriteData*> sprites(visibleSprites.begin(), visibleSprites.begin() + SpriteManager.GetVisibleSpriteCount());
+
+			auto windowVisible = (lcdc & 0x20) && y >= readByte(0xff4a) && readByte(0xff4b) < 167;
+			int expected[Graphics::HozPixels];
+
+			for (auto x = 0; x < static_cast<int>(Graphics::HozPixels); x++)
+			{
+				auto windowX = x - readByte(0xff4b) + 7;
+				auto colour = windowVisible && windowX >= 0 ? bgOrWinColour(windowX, windowLine, true)
+					: lcdc & 0x1 ? bgOrWinColour(x + readByte(0xff43), y + readByte(0xff42), false) : 0;
+
+				expected[x] = shade(colour, 0xff47);
+				if (!(lcdc & 0x2)) continue;
+
+				auto first = std::find_if(sprites.begin(), sprites.end(), [&](const SpriteData* sprite) { return sprite->XPos > x; });
+
+				for (auto sprite = first; sprite != sprites.end() && (*sprite)->XPos - 8 <= x && (!((*sprite)->Flags & SpriteFlags::ZPriority) || colour == 0); ++sprite)
+				{
+					auto patternX = x - (*sprite)->XPos + 8;
+					auto patternY = y - (*sprite)->YPos + 16;
+					if ((*sprite)->Flags & SpriteFlags::XFlip) patternX = 7 - patternX;
+					if ((*sprite)->Flags & SpriteFlags::YFlip) patternY = spriteHeight - 1 - patternY;
+
+					auto patternNum = tallSprites ? (*sprite)->PatternNum & 0xfe | (patternY & 0x8) >> 3 : (*sprite)->PatternNum;
+					auto spriteColour = tileColour(patternNum * 16, patternX, patternY);
+
+					if (spriteColour != 0)
+					{
+						expected[x] = shade(spriteColour, (*first)->Flags & SpriteFlags::PaletteSelector ? 0xff49 : 0xff48);
+						break;
+					}
+				}
+			}
+
+			if (windowVisible) windowLine++;
 
 			Graphics.RenderLine();
+
+			for (auto x = 0; x < static_cast<int>(Graphics::HozPixels); x++)
+			{
+				ASSERT_EQ(expected[x], Graphics.Bitmap[y * Graphics::HozPixels + x]) << "scene " << scene << " x " << x << " y " << y;
+			}
 		}
+
+		for (auto y = Graphics::VertPixels; y < Graphics::VertPixels + Graphics::VBlankLines; y++) Graphics.RenderLine();
 	}
 }
+
+TEST_F(GraphicsTestFixture, SpriteSelection)
+{
+	const int topLine = SpriteManager::SpriteYOffset;
+	const int maxSprites = SpriteManager::MaxSpritesPerLine;
+
+	// Twelve sprites on the first line, in descending X order with a tie between the first two
+	for (auto sprite = 0; sprite < 12; sprite++)
+	{
+		MemoryMap.WriteByte(0xfe00 + sprite * 4, topLine);
+		MemoryMap.WriteByte(0xfe00 + sprite * 4 + 1, 100 - std::max(sprite, 1) * 8);
+	}
+
+	// One below the line, which isn't picked
+	MemoryMap.WriteByte(0xfe00 + 12 * 4, topLine + 1);
+	MemoryMap.WriteByte(0xfe00 + 12 * 4 + 1, 50);
+
+	SpriteManager.SetScanline(0);
+
+	// Only the first ten in OAM are on the line, ordered by X and then OAM index
+	auto& sprites = SpriteManager.GetVisibleSprites();
+	ASSERT_EQ(maxSprites, SpriteManager.GetVisibleSpriteCount());
+
+	auto oam = reinterpret_cast<const SpriteData*>(sprites[maxSprites - 1]) - 1;
+	for (auto i = 0; i < maxSprites - 2; i++)
+	{
+		EXPECT_EQ(oam + (maxSprites - 1 - i), sprites[i]);
+	}
+
+	EXPECT_EQ(oam, sprites[8]);
+	EXPECT_EQ(oam + 1, sprites[9]);
+
+	// Moving a sprite drops it from the line until sprites are next picked
+	MemoryMap.WriteByte(0xfe00 + 5 * 4 + 1, 20);
+	EXPECT_EQ(maxSprites - 1, SpriteManager.GetVisibleSpriteCount());
+	EXPECT_EQ(sprites.begin() + SpriteManager.GetVisibleSpriteCount(), std::find(sprites.begin(), sprites.begin() + SpriteManager.GetVisibleSpriteCount(), oam + 5));
+}
+
+TEST_F(GraphicsTestFixture, OamDma)
+{
+	/* Standard DMA routine in high RAM, reading work RAM while the transfer blocks it and after:
+	*
+	* 0xff80 0x3e 0xc1				LD A, 0xc1
+	* 0xff82 0xe0 0x46				LDH (0x46), A
+	* 0xff84 0xfa 0x00 0xc0		LD A, (0xc000)
+	* 0xff87 0x47					LD B, A
+	* 0xff88 0x3e 0x28				LD A, 0x28
+	* 0xff8a 0x3d					DEC A
+	* 0xff8b 0x20 0xfd				JR NZ, -3
+	* 0xff8d 0xfa 0x00 0xc0		LD A, (0xc000)
+	*/
+	MemoryMap.SetBytes(MemoryMap::HighRam, { 0x3e, 0xc1, 0xe0, 0x46, 0xfa, 0x00, 0xc0, 0x47, 0x3e, 0x28, 0x3d, 0x20, 0xfd, 0xfa, 0x00, 0xc0 });
+
+	MemoryMap.WriteByte(0xc000, 0x42);
+
+	// First sprite on the top line, the rest hidden above the screen
+	const int topLine = SpriteManager::SpriteYOffset;
+	auto oamByte = [topLine](unsigned short i) { return i % 4 != 0 ? i : i == 0 ? topLine : 0; };
+
+	for (unsigned short i = 0; i < Graphics::OamSize; i++) MemoryMap.WriteByte(0xc100 + i, oamByte(i));
+
+	auto& reg = Cpu.Registers();
+	reg.PC = MemoryMap::HighRam;
+
+	const auto transferCycles = 8 + 12 + 16;
+	EXPECT_EQ(transferCycles, Cpu.RunCycles(transferCycles));
+	EXPECT_TRUE(MemoryMap.IsOamDmaActive());
+
+	// Blocked reads see open bus
+	Cpu.RunCycles(4);
+	EXPECT_EQ(0xff, reg.B);
+
+	const auto waitCycles = 8 + 0x28 * 16 - 4;
+	Cpu.RunCycles(waitCycles + 16);
+	EXPECT_EQ(0x42, reg.A);
+	EXPECT_FALSE(MemoryMap.IsOamDmaActive());
+
+	for (unsigned short i = 0; i < Graphics::OamSize; i++)
+	{
+		EXPECT_EQ(oamByte(i), Graphics.ReadOam(i));
+	}
+
+	SpriteManager.SetScanline(0);
+	ASSERT_EQ(1, SpriteManager.GetVisibleSpriteCount());
+	EXPECT_EQ(topLine, SpriteManager.GetVisibleSprites()[0]->YPos);
+}
@@ -1,3 +1,5 @@
 #include "stdafx.h"
 #include "TestCpu.h"
+#include "../core/CpuImpl.h"
 
+template class CpuCore<TestMemoryMap>;
@@ -2,16 +2,21 @@
 #include "../core/Cpu.h"
 #include "TestMemoryMap.h"
 
-class TestCpu : public Cpu
+// Exposes CPU internals to tests. CPU tests run it against the test memory map as its bus, while tests
+// of components wired to the production CPU (such as Graphics) use MemoryMap
+template<typename Bus = TestMemoryMap>
+class TestCpu : public CpuCore<Bus>
 {
 public:
-	explicit TestCpu(TestMemoryMap& memory) : Cpu(memory) {}
+	explicit TestCpu(Bus& memory) : CpuCore<Bus>(memory) {}
 	~TestCpu() = default;
 
-	Registers& Registers() { return _registers; }
+	::Registers& Registers() { return this->_registers; }
 
-	bool& InterruptsEnabled() { return _interruptsEnabled; }
-	unsigned char& EnabledInterrupts() { return _enabledInterrupts; }
-	unsigned char& WaitingInterrupts() { return _waitingInterrupts; }
-};
+	bool& InterruptsEnabled() { return this->_interruptsEnabled; }
+	unsigned char& EnabledInterrupts() { return this->_enabledInterrupts; }
+	unsigned char& WaitingInterrupts() { return this->_waitingInterrupts; }
 
+	DecodedBlockCache& BlockCache() { return this->_blockCache; }
+	::Recompiler& Recompiler() { return this->_recompiler; }
+};
@@ -4,8 +4,9 @@
 class TestGraphics : public Graphics
 {
 public:
-	using Graphics::GetBgOrWinColour;
-	using Graphics::MapColour;
+	using Graphics::FetchTileRow;
+	using Graphics::DrawSprites;
+	using Graphics::UpdatePalette;
 	
 	using Graphics::DisplayEnabled;
 	using Graphics::WindowEnabled;
@@ -34,9 +34,12 @@ void TestMemoryMap::SetBytes(unsigned short address, std::vector<unsigned char>&
 			WriteByte(address++, byte);
 		}
 	}
+
+	if (_flushDecodedCode) _flushDecodedCode();
 }
 
 void TestMemoryMap::SetInternalRomEnabled(bool enabled)
 {
 	_internalRomEnabled = enabled;
+	MapRom();
 }
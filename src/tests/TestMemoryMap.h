@@ -1,18 +1,39 @@
 #pragma once
+#include <functional>
 #include <vector>
 #include "../core/Cartridge.h"
 #include "../core/MemoryMap.h"
 
+// ROM image that tests patch code into
+class TestRomImage : public RomImage
+{
+public:
+	TestRomImage() : RomImage(std::vector<unsigned char>(MemoryMap::RomBankSize))
+	{
+	}
+
+	void SetBytes(unsigned short address, std::vector<unsigned char>&& bytes)
+	{
+		memcpy(_buffer.data() + address, bytes.data(), bytes.size());
+	}
+};
+
 class TestCartridge : public Cartridge
 {
+	std::shared_ptr<TestRomImage> _testRom;
+
+	explicit TestCartridge(std::shared_ptr<TestRomImage> rom) : Cartridge(rom, 1), _testRom(rom)
+	{
+	}
+
 public:
-	TestCartridge::TestCartridge() : Cartridge(std::vector<unsigned char>(MemoryMap::RomBankSize), 1)
+	TestCartridge() : TestCartridge(std::make_shared<TestRomImage>())
 	{
 	}
 
 	void SetBytes(unsigned short address, std::vector<unsigned char>&& bytes)
 	{
-		memcpy(_rom.data() + address, bytes.data(), bytes.size());
+		_testRom->SetBytes(address, std::move(bytes));
 	}
 };
 
@@ -20,6 +41,9 @@ class TestMemoryMap : public MemoryMap
 {
 	std::shared_ptr<TestCartridge> _testCartridge;
 
+	// Called when memory contents are patched, so that the CPU doesn't run stale decoded code
+	std::function<void()> _flushDecodedCode;
+
 public:
 	const int TestRamSize = 0x20;
 
@@ -36,5 +60,7 @@ public:
 	void SetBytes(unsigned short address, std::vector<unsigned char>&& bytes);
 
 	void SetInternalRomEnabled(bool enabled);
+
+	template<typename CpuType> void SetCpu(CpuType* cpu) { _flushDecodedCode = [cpu] { cpu->FlushDecodedCode(); }; }
 };
 
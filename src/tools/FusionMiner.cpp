@@ -0,0 +1,98 @@
+#include "stdafx.h"
+#include "FusionMiner.h"
+#include "../core/CartridgeFactory.h"
+#include "../core/Cpu.h"
+#include "../core/Graphics.h"
+#include "../core/InputJoypad.h"
+#include "../core/MemoryMap.h"
+#include "../core/SpriteManager.h"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <vector>
+
+namespace
+{
+	// Lets the miner see where each instruction is fetched from
+	class TracingCpu : public Cpu
+	{
+	public:
+		explicit TracingCpu(MemoryMap& memory) : Cpu(memory) {}
+
+		unsigned short PC() const { return _registers.PC; }
+	};
+}
+
+bool FusionMiner::Run(const std::string& romPath, int frames, std::ostream& output)
+{
+	auto cartridge = CartridgeFactory::LoadFromFile(romPath);
+	if (cartridge == nullptr)
+	{
+		output << "Can't load " << romPath << std::endl;
+		return false;
+	}
+
+	InputJoypad joypad;
+	MemoryMap memoryMap{ joypad };
+	TracingCpu cpu{ memoryMap };
+	SpriteManager spriteManager;
+	Graphics graphics{ cpu, memoryMap, spriteManager };
+
+	memoryMap.SetCartridge(cartridge);
+
+	std::map<std::vector<unsigned char>, int> sequenceCounts;
+	std::vector<unsigned char> sequence;
+	unsigned short nextPC = 0;
+
+	auto runTracingSequences = [&](int& currentCycle, int cycleTarget)
+	{
+		while (currentCycle < cycleTarget)
+		{
+			if (cpu.IsClockRunning())
+			{
+				auto pc = cpu.PC();
+				auto opcode = memoryMap.ReadByte(pc);
+
+				// Anything other than falling through from the last instruction (a jump, or an interrupt) starts afresh
+				if (pc != nextPC || opcode == 0xcb) sequence.clear();
+
+				if (opcode != 0xcb)
+				{
+					sequence.push_back(opcode);
+					if (sequence.size() > 3) sequence.erase(sequence.begin());
+
+					for (auto length = 2u; length <= sequence.size(); length++)
+					{
+						sequenceCounts[std::vector<unsigned char>(sequence.end() - length, sequence.end())]++;
+					}
+
+					if (DecodedBlockCache::EndsBlock(opcode)) sequence.clear();
+				}
+
+				nextPC = pc + DecodedBlockCache::GetInstructionLength(opcode);
+			}
+
+			currentCycle += cpu.DoNextInstruction();
+		}
+	};
+
+	for (auto frame = 0; frame < frames; frame++)
+	{
+		graphics.RunFrame(runTracingSequences);
+	}
+
+	std::vector<std::pair<int, std::vector<unsigned char>>> rankedSequences;
+	for (auto& count : sequenceCounts) rankedSequences.emplace_back(count.second, count.first);
+	std::sort(rankedSequences.rbegin(), rankedSequences.rend());
+
+	output << "Most frequent opcode sequences:" << std::endl;
+
+	for (auto i = 0u; i < std::min<size_t>(rankedSequences.size(), 20); i++)
+	{
+		output << "  " << std::setw(9) << std::dec << rankedSequences[i].first << " ";
+		for (auto opcode : rankedSequences[i].second) output << " 0x" << std::setw(2) << std::setfill('0') << std::hex << static_cast<int>(opcode) << std::setfill(' ');
+		output << std::endl;
+	}
+
+	return true;
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <ostream>
+#include <string>
+
+// Finds candidates for CPU_FUSED_TABLE. Runs the internal ROM and the start of a game one instruction at a
+// time, counting the opcode pairs and triples that run back to back within a basic block
+class FusionMiner
+{
+public:
+	// Reports the most frequent sequences to output. Returns false if the ROM can't be loaded
+	static bool Run(const std::string& romPath, int frames, std::ostream& output);
+};
@@ -0,0 +1,66 @@
+#include "stdafx.h"
+#include "RenderBenchmark.h"
+#include "../core/CartridgeFactory.h"
+#include "../core/Emulator.h"
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+
+namespace
+{
+	// Start now and then, otherwise alternately up and left, changing every half second
+	JoypadKey ScriptedKeys(int frame)
+	{
+		if ((frame / 60) % 3 == 0) return JoypadKey::Start;
+		return (frame / 30) % 2 != 0 ? JoypadKey::Left : JoypadKey::Up;
+	}
+
+	const char* EngineName(CpuEngine engine)
+	{
+		switch (engine)
+		{
+		case CpuEngine::JumpTable: return "JumpTable";
+		case CpuEngine::Threaded: return "Threaded";
+		default: return "Recompiler";
+		}
+	}
+}
+
+bool RenderBenchmark::Run(const std::string& romPath, int frames, std::ostream& output)
+{
+	for (auto engine : { CpuEngine::JumpTable, CpuEngine::Threaded, CpuEngine::Recompiler })
+	{
+		auto cartridge = CartridgeFactory::LoadFromFile(romPath);
+		if (cartridge == nullptr)
+		{
+			output << "Can't load " << romPath << std::endl;
+			return false;
+		}
+
+		Emulator emulator{ cartridge, engine };
+
+		// 64-bit FNV-1a over every frame
+		uint64_t hash = 0xcbf29ce484222325;
+		std::chrono::steady_clock::duration elapsed{};
+
+		for (auto frame = 0; frame < frames; frame++)
+		{
+			emulator.GetJoypad().SetKeysDown(ScriptedKeys(frame));
+
+			auto start = std::chrono::steady_clock::now();
+			auto bytes = reinterpret_cast<const unsigned char*>(emulator.GetFrame());
+			elapsed += std::chrono::steady_clock::now() - start;
+
+			for (unsigned int i = 0; i < emulator.GetFrameSize(); i++) hash = (hash ^ bytes[i]) * 0x100000001b3;
+		}
+
+		auto totalMs = std::chrono::duration<double, std::milli>(elapsed).count();
+
+		output << std::left << std::setw(12) << EngineName(engine) << std::right
+			<< frames << " frames in " << std::fixed << std::setprecision(1) << totalMs << " ms, "
+			<< std::setprecision(1) << totalMs * 1000 / frames << " us/frame, hash "
+			<< std::hex << std::setfill('0') << std::setw(16) << hash << std::dec << std::setfill(' ') << std::endl;
+	}
+
+	return true;
+}
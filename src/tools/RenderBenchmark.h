@@ -0,0 +1,13 @@
+#pragma once
+#include <ostream>
+#include <string>
+
+// Times whole frames of a ROM, CPU and rendering together, on each CPU engine. Input is scripted so that
+// the game gets past its title screen, and every frame is hashed so that runs of different builds can be
+// checked to have drawn the same thing
+class RenderBenchmark
+{
+public:
+	// Reports the time per frame on each engine to output. Returns false if the ROM can't be loaded
+	static bool Run(const std::string& romPath, int frames, std::ostream& output);
+};
@@ -0,0 +1,22 @@
+#include "stdafx.h"
+#include "FusionMiner.h"
+#include "RenderBenchmark.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// Tools for measuring the emulator, kept out of the unit tests:
+//   Tools bench [rom] [frames]	times frames of a ROM on each CPU engine
+//   Tools fusion [rom] [frames]	counts the opcode sequences a ROM runs, for CPU_FUSED_TABLE
+int main(int argc, char* argv[])
+{
+	std::string tool = argc > 1 ? argv[1] : "";
+	std::string romPath = argc > 2 ? argv[2] : "../../ROMs/gb-snake.gb";
+	auto frames = argc > 3 ? std::atoi(argv[3]) : tool == "fusion" ? 300 : 3000;
+
+	if (tool == "bench" && frames > 0) return RenderBenchmark::Run(romPath, frames, std::cout) ? 0 : 1;
+	if (tool == "fusion" && frames > 0) return FusionMiner::Run(romPath, frames, std::cout) ? 0 : 1;
+
+	std::cerr << "Usage: Tools bench|fusion [rom] [frames]" << std::endl;
+	return 1;
+}
@@ -43,7 +43,8 @@ int main()
 	sprite.setTexture(texture);
 	sprite.scale(4, 4);
 
-	auto cartridge = CartridgeFactory::LoadFromFile("../../ROMs/gb-snake.gb", 0);
+	const std::string romPath = "../../ROMs/gb-snake.gb";
+	auto cartridge = CartridgeFactory::LoadFromFile(romPath, CartridgeFactory::GetSavePath(romPath));
 	if (cartridge != nullptr)
 	{
 		Emulator emulator{ cartridge };